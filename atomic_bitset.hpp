@@ -0,0 +1,71 @@
+// AtomicBitset is a fixed size bitset whose bits can be set concurrently
+// without locks. phantom uses it to track which reference entries were seen
+// during a compare run.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef ATOMIC_BITSET_HPP
+#define ATOMIC_BITSET_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+
+class AtomicBitset {
+
+public:
+
+  AtomicBitset() {};
+
+  AtomicBitset(const AtomicBitset& b) = delete;
+  AtomicBitset& operator=(const AtomicBitset& b) = delete;
+
+  // reset resizes the bitset to size bits and clears all of them
+  void reset(size_t size) {
+    size_ = size;
+    numWords_ = (size + 63) / 64;
+    words_.reset(new std::atomic<uint64_t>[numWords_]);
+    for (size_t w = 0; w < numWords_; ++w) {
+      words_[w].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // set sets bit i
+  void set(size_t i) {
+    words_[i / 64].fetch_or(uint64_t(1) << (i % 64), std::memory_order_relaxed);
+  }
+
+  bool test(size_t i) const {
+    return words_[i / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (i % 64));
+  }
+
+  // for_each_unset calls fn with the index of every unset bit in increasing
+  // order; fully set words are skipped as a whole
+  template <typename F>
+  void for_each_unset(F fn) const {
+    for (size_t w = 0; w < numWords_; ++w) {
+      uint64_t unset = ~words_[w].load(std::memory_order_relaxed);
+      while (unset != 0) {
+        size_t i = w * 64 + __builtin_ctzll(unset);
+        if (i >= size_) {
+          return;
+        }
+        fn(i);
+        unset &= unset - 1;
+      }
+    }
+  }
+
+private:
+
+  size_t size_ = 0;
+  size_t numWords_ = 0;
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+};
+
+#endif
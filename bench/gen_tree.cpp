@@ -0,0 +1,238 @@
+// gen_tree generates deterministic synthetic file system trees for
+// benchmarking phantom. For a given profile, scale and seed the generated
+// tree (names, sizes and content) is always identical so results of
+// different runs and machines can be compared. Available profiles:
+//
+//   tiny   - many tiny files (0 - 4 KB) spread over directories of 100 files
+//   huge   - a few huge files
+//   deep   - a deeply nested chain of directories with a few files per level
+//   wide   - a single directory with a very large number of entries
+//   sparse - large sparse files with small data extents
+//   all    - all of the above, each in a subdirectory named after the profile
+//
+// usage: gen_tree <root> [profile] [scale] [seed]
+//
+// (C) Markus Dittrich 2015
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// TreeStats keeps track of what was generated
+struct TreeStats {
+  long long files = 0;
+  long long dirs = 0;
+  long long bytes = 0;
+};
+
+
+static void die(const std::string& msg) {
+  std::cerr << "gen_tree: " << msg << ": " << strerror(errno) << "\n";
+  exit(1);
+}
+
+
+static void make_dir(const std::string& path, TreeStats& stats) {
+  if (mkdir(path.c_str(), 0755) < 0) {
+    die("failed to create " + path);
+  }
+  ++stats.dirs;
+}
+
+
+// uniform returns a value in [0, max]. Unlike std::uniform_int_distribution
+// the result does not depend on the standard library implementation.
+static long long uniform(std::mt19937_64& rng, long long max) {
+  return rng() % (max + 1);
+}
+
+
+// fill fills buf with pseudo random bytes (xorshift64*) derived from state
+static void fill(std::vector<char>& buf, size_t size, unsigned long long& state) {
+  for (size_t i = 0; i < size; i += 8) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    unsigned long long v = state * 2685821657736338717ULL;
+    memcpy(buf.data() + i, &v, std::min<size_t>(8, size - i));
+  }
+}
+
+
+// write_file writes a file of size bytes. If extent is non-zero the file
+// is sparse and only contains a data extent of extent bytes every stride
+// bytes. Content is derived from contentSeed.
+static void write_file(const std::string& path, long long size,
+  unsigned long long contentSeed, TreeStats& stats, long long extent = 0,
+  long long stride = 0) {
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    die("failed to create " + path);
+  }
+
+  const size_t blockSize = 1024*1024;
+  std::vector<char> buf(blockSize);
+  unsigned long long state = contentSeed | 1;
+  if (extent > 0) {
+    if (ftruncate(fd, size) < 0) {
+      die("failed to truncate " + path);
+    }
+    for (long long off = 0; off < size; off += stride) {
+      size_t n = std::min(extent, size - off);
+      fill(buf, n, state);
+      if (pwrite(fd, buf.data(), n, off) != static_cast<ssize_t>(n)) {
+        die("failed to write " + path);
+      }
+    }
+  } else {
+    for (long long off = 0; off < size; off += blockSize) {
+      size_t n = std::min<long long>(blockSize, size - off);
+      fill(buf, n, state);
+      if (write(fd, buf.data(), n) != static_cast<ssize_t>(n)) {
+        die("failed to write " + path);
+      }
+    }
+  }
+  close(fd);
+  ++stats.files;
+  stats.bytes += size;
+}
+
+
+static void gen_tiny(const std::string& root, double scale,
+  std::mt19937_64& rng, TreeStats& stats) {
+
+  long long numFiles = 20000 * scale;
+  std::string dir;
+  for (long long i = 0; i < numFiles; ++i) {
+    if (i % 100 == 0) {
+      dir = root + "/d" + std::to_string(i / 100);
+      make_dir(dir, stats);
+    }
+    write_file(dir + "/f" + std::to_string(i), uniform(rng, 4096), rng(),
+      stats);
+  }
+}
+
+
+static void gen_huge(const std::string& root, double scale,
+  std::mt19937_64& rng, TreeStats& stats) {
+
+  long long fileSize = 256 * scale * 1024 * 1024;
+  for (int i = 0; i < 4; ++i) {
+    write_file(root + "/huge" + std::to_string(i), fileSize, rng(), stats);
+  }
+}
+
+
+static void gen_deep(const std::string& root, double scale,
+  std::mt19937_64& rng, TreeStats& stats) {
+
+  long long depth = 200 * scale;
+  std::string dir = root;
+  for (long long d = 0; d < depth; ++d) {
+    dir += "/l" + std::to_string(d);
+    make_dir(dir, stats);
+    for (int i = 0; i < 3; ++i) {
+      write_file(dir + "/f" + std::to_string(i), uniform(rng, 64*1024), rng(),
+        stats);
+    }
+  }
+}
+
+
+static void gen_wide(const std::string& root, double scale,
+  std::mt19937_64& rng, TreeStats& stats) {
+
+  long long numFiles = 50000 * scale;
+  for (long long i = 0; i < numFiles; ++i) {
+    write_file(root + "/entry_with_a_longer_name_" + std::to_string(i),
+      uniform(rng, 512), rng(), stats);
+  }
+}
+
+
+static void gen_sparse(const std::string& root, double scale,
+  std::mt19937_64& rng, TreeStats& stats) {
+
+  long long fileSize = 128 * scale * 1024 * 1024;
+  for (int i = 0; i < 8; ++i) {
+    write_file(root + "/sparse" + std::to_string(i), fileSize, rng(), stats,
+      4096, 1024*1024);
+  }
+}
+
+
+using Generator = void (*)(const std::string&, double, std::mt19937_64&,
+  TreeStats&);
+
+struct Profile {
+  const char* name;
+  Generator gen;
+};
+
+static const std::vector<Profile> profiles = {
+  {"tiny", gen_tiny},
+  {"huge", gen_huge},
+  {"deep", gen_deep},
+  {"wide", gen_wide},
+  {"sparse", gen_sparse}
+};
+
+
+int main(int argc, char** argv) {
+
+  if (argc < 2) {
+    std::cerr << "usage: gen_tree <root> [tiny|huge|deep|wide|sparse|all] "
+              << "[scale] [seed]\n";
+    return 1;
+  }
+  std::string root = argv[1];
+  std::string profile = argc > 2 ? argv[2] : "all";
+  double scale = argc > 3 ? atof(argv[3]) : 1.0;
+  unsigned long long seed = argc > 4 ? strtoull(argv[4], NULL, 10) : 42;
+  if (scale <= 0) {
+    std::cerr << "gen_tree: scale has to be positive\n";
+    return 1;
+  }
+
+  bool found = profile == "all";
+  for (const auto& p : profiles) {
+    found = found || profile == p.name;
+  }
+  if (!found) {
+    std::cerr << "gen_tree: unknown profile " << profile << "\n";
+    return 1;
+  }
+
+  TreeStats stats;
+  make_dir(root, stats);
+  for (const auto& p : profiles) {
+    if (profile != "all" && profile != p.name) {
+      continue;
+    }
+    // each profile has its own generator so profiles are identical whether
+    // generated on their own or as part of all
+    std::mt19937_64 rng(seed);
+    std::string dir = root;
+    if (profile == "all") {
+      dir += "/" + std::string(p.name);
+      make_dir(dir, stats);
+    }
+    p.gen(dir, scale, rng, stats);
+  }
+
+  std::cout << "profile, files, dirs, bytes\n"
+            << profile << ", " << stats.files << ", " << stats.dirs << ", "
+            << stats.bytes << "\n";
+}
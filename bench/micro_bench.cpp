@@ -0,0 +1,393 @@
+// micro_bench runs microbenchmarks of phantom's building blocks:
+//
+//   hasher        - Hasher on files of different sizes (served from the
+//                   page cache) for several digests and read engines
+//   batch         - Hasher on batches of small files, multi-buffer kernels
+//                   versus one file at a time
+//   queue         - push/pop pairs on Pqueue, Bqueue and WSqueue with an
+//                   increasing number of contending threads
+//   refdata       - load_reference_data() on text and binary references
+//   add_directory - add_directory() on directories with many entries
+//
+// Results are written to stdout as csv with the columns
+//   benchmark, parameter, threads, iterations, seconds, rate, unit
+// so they can be collected and compared across revisions.
+//
+// usage: micro_bench [-t max threads] [-l ref lines] [-d tmp dir]
+//                    [benchmark ...]
+//
+// (C) Markus Dittrich 2015
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "hash.hpp"
+#include "parallel_queue.hpp"
+#include "reader.hpp"
+#include "refParser.hpp"
+#include "refdb.hpp"
+#include "util.hpp"
+#include "ws_queue.hpp"
+
+
+// BenchOpts holds the settings of a micro_bench run
+struct BenchOpts {
+  int maxThreads = std::thread::hardware_concurrency();
+  std::vector<long long> refLines{1000000, 10000000};
+  std::string workDir;
+};
+
+
+// report prints a single result line
+static void report(const std::string& name, const std::string& param,
+  int threads, long long iterations, double seconds, double rate,
+  const std::string& unit) {
+  std::cout << name << ", " << param << ", " << threads << ", " << iterations
+            << ", " << seconds << ", " << rate << ", " << unit << std::endl;
+}
+
+
+// time_it returns the time in seconds it takes to run f
+template <typename F>
+static double time_it(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// make_file creates a file of size bytes with non-constant content
+static void make_file(const std::string& path, long long size) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  std::vector<char> buf(1024*1024);
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = static_cast<char>(i * 2654435761U >> 13);
+  }
+  for (long long off = 0; off < size; off += buf.size()) {
+    out.write(buf.data(), std::min<long long>(buf.size(), size - off));
+  }
+  if (!out) {
+    error("failed to write " + path);
+  }
+}
+
+
+static void bench_hasher(const BenchOpts& opts) {
+  const std::vector<long long> sizes{4096, 64*1024, 1024*1024, 16*1024*1024,
+    256*1024*1024};
+  const std::vector<std::string> digests{"md5", "sha256", "blake3"};
+  const std::vector<std::string> modes{"read", "async", "mmap"};
+  const long long targetBytes = 512*1024*1024;
+
+  for (auto size : sizes) {
+    std::string path = opts.workDir + "/hash_" + std::to_string(size);
+    make_file(path, size);
+    FileEntry file(path);
+    long long iterations = std::max(5LL, targetBytes / size);
+    for (const auto& d : digests) {
+      // small files bypass the read engine
+      for (const auto& m : modes) {
+        auto engine = make_read_engine(m, defaultBufferSize, defaultQueueDepth);
+        Hasher hasher({d}, *engine);
+        hasher.hash(file, size);  // warm up the page cache
+        double t = time_it([&]() {
+          for (long long i = 0; i < iterations; ++i) {
+            hasher.hash(file, size);
+          }
+        });
+        std::string mode = Hasher::is_small(size) ? smallFileMode : m;
+        report("hasher", d + "/" + mode + "/" + std::to_string(size), 1,
+          iterations, t, iterations * size / t / 1024 / 1024, "MB/s");
+        if (Hasher::is_small(size)) {
+          break;
+        }
+      }
+    }
+    unlink(path.c_str());
+  }
+}
+
+
+// bench_batch hashes batches of small files (served from the page cache)
+// with the multi-buffer kernels and compares them with hashing the same
+// files one at a time
+static void bench_batch(const BenchOpts& opts) {
+  const std::vector<long long> sizes{512, 4096, 32*1024, 64*1024};
+  const std::vector<std::string> digests{"md5", "sha1"};
+  const std::vector<size_t> batchSizes{1, 8, 32, 128};
+  const long long numFiles = 128;
+  const long long targetBytes = 256*1024*1024;
+
+  for (auto size : sizes) {
+    std::vector<FileEntry> files;
+    for (long long i = 0; i < numFiles; ++i) {
+      std::string path = opts.workDir + "/batch_" + std::to_string(i);
+      make_file(path, size);
+      files.push_back(FileEntry(path));
+    }
+    long long rounds = std::max(3LL, targetBytes / (size * numFiles));
+    for (const auto& d : digests) {
+      auto engine = make_read_engine("read", defaultBufferSize,
+        defaultQueueDepth);
+      for (auto b : batchSizes) {
+        Hasher hasher({d}, *engine, 1, b);
+        double t = time_it([&]() {
+          for (long long r = 0; r < rounds; ++r) {
+            for (const auto& f : files) {
+              if (!hasher.batching()) {
+                hasher.hash(f, size);
+                continue;
+              }
+              hasher.add_to_batch(f, size);
+              if (hasher.batch_full()) {
+                hasher.finish_batch();
+              }
+            }
+            if (hasher.batching()) {
+              hasher.finish_batch();
+            }
+          }
+        });
+        long long n = rounds * numFiles;
+        report("batch", d + "/" + std::to_string(size) + "/" + std::to_string(b),
+          1, n, t, n * size / t / 1024 / 1024, "MB/s");
+      }
+    }
+    for (const auto& f : files) {
+      unlink(f.path().c_str());
+    }
+  }
+}
+
+
+// run_pairs starts nthreads threads which each call op(thread id, i) for
+// i in [0, pairs) and returns the elapsed time
+template <typename F>
+static double run_pairs(int nthreads, long long pairs, F op) {
+  return time_it([&]() {
+    std::vector<std::thread> threads;
+    for (int id = 0; id < nthreads; ++id) {
+      threads.push_back(std::thread([&, id]() {
+        for (long long i = 0; i < pairs; ++i) {
+          op(id, i);
+        }
+      }));
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  });
+}
+
+
+// bench_queue measures push/pop pairs where every thread pushes an element
+// and then pops one. Since each pop is preceded by a push of the same
+// thread, pops never have to wait for an element.
+static void bench_queue(const BenchOpts& opts) {
+  const long long totalPairs = 2000000;
+  const std::string elem("/some/typical/path/to/a/file.dat");
+
+  for (int n = 1; n <= opts.maxThreads; n *= 2) {
+    long long pairs = totalPairs / n;
+
+    StringQueue pq(n);
+    double t = run_pairs(n, pairs, [&](int, long long) {
+      pq.push(elem);
+      pq.try_pop();
+    });
+    report("queue", "Pqueue", n, pairs * n, t, pairs * n / t, "pairs/s");
+
+    StringBQueue bq("bench", defaultStageQueueSize);
+    t = run_pairs(n, pairs, [&](int, long long) {
+      bq.push(std::string(elem));
+      std::string s;
+      bq.pop(s);
+    });
+    report("queue", "Bqueue", n, pairs * n, t, pairs * n / t, "pairs/s");
+
+    StringWSQueue wq(n);
+    t = run_pairs(n, pairs, [&](int id, long long) {
+      wq.push(id, std::string(elem));
+      std::string s;
+      wq.try_pop(id, s);
+    });
+    report("queue", "WSqueue", n, pairs * n, t, pairs * n / t, "pairs/s");
+  }
+}
+
+
+// write_reference writes a text reference with numLines entries
+static void write_reference(const std::string& path, long long numLines) {
+  std::ofstream out(path, std::ios::trunc);
+  char hash[33];
+  for (long long i = 0; i < numLines; ++i) {
+    snprintf(hash, sizeof(hash), "%016llx%016llx", i * 0x9e3779b97f4a7c15ULL,
+      ~i * 0xc2b2ae3d27d4eb4fULL);
+    out << "md5 , /data/bench/d" << i / 1000 << "/file_" << i << ".dat , "
+        << hash << " , " << i % 100000 << " , 1444000000000000000 , "
+        << "1444000000000000000 , " << i << " , 2049\n";
+  }
+  if (!out) {
+    error("failed to write " + path);
+  }
+}
+
+
+static void bench_refdata(const BenchOpts& opts) {
+  for (auto lines : opts.refLines) {
+    std::string text = opts.workDir + "/ref.txt";
+    std::string db = opts.workDir + "/ref.db";
+    write_reference(text, lines);
+
+    RefDb ref;
+    double t = time_it([&]() { ref = load_reference_data(text); });
+    if (ref.size() != static_cast<size_t>(lines)) {
+      error("failed to load reference " + text);
+    }
+    report("refdata", "text/" + std::to_string(lines), 1, lines, t, lines / t,
+      "lines/s");
+
+    ref.write(db);
+    ref = RefDb();
+    t = time_it([&]() { ref = load_reference_data(db); });
+    report("refdata", "db/" + std::to_string(lines), 1, lines, t, lines / t,
+      "lines/s");
+
+    ref = RefDb();
+    unlink(text.c_str());
+    unlink(db.c_str());
+  }
+}
+
+
+static void bench_add_directory(const BenchOpts& opts) {
+  const std::vector<long long> entries{1000, 10000, 100000};
+  const long long targetEntries = 1000000;
+  Printer printer;
+
+  for (auto n : entries) {
+    std::string dir = opts.workDir + "/dir_" + std::to_string(n);
+    if (mkdir(dir.c_str(), 0755) < 0) {
+      error("failed to create " + dir);
+    }
+    for (long long i = 0; i < n; ++i) {
+      std::string path = dir + "/entry_" + std::to_string(i);
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+      if (fd < 0) {
+        error("failed to create " + path);
+      }
+      close(fd);
+    }
+
+    long long iterations = std::max(3LL, targetEntries / n);
+    StringWSQueue dirQueue(1);
+    FileQueue fileQueue("bench", n + 1);
+    double t = time_it([&]() {
+      for (long long i = 0; i < iterations; ++i) {
+        add_directory(dirQueue, 0, fileQueue, dir, Shard{}, printer);
+        FileEntry f;
+        while (fileQueue.try_pop(f)) {}
+      }
+    });
+    report("add_directory", std::to_string(n), 1, iterations, t,
+      iterations * n / t, "entries/s");
+  }
+}
+
+
+static int remove_entry(const char* path, const struct stat*, int,
+  struct FTW*) {
+  return remove(path);
+}
+
+
+static void bench_usage() {
+  std::cerr << "usage: micro_bench [-t max threads] [-l ref lines] [-d tmp dir] "
+            << "[hasher|batch|queue|refdata|add_directory ...]\n"
+            << "\t-l takes a comma separated list of reference sizes "
+            << "(default 1000000,10000000)\n";
+  exit(1);
+}
+
+
+int main(int argc, char** argv) {
+
+  BenchOpts opts;
+  std::string tmpDir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+  int c;
+  while ((c = getopt(argc, argv, "t:l:d:h")) != -1) {
+    switch (c) {
+      case 't':
+        opts.maxThreads = atoi(optarg);
+        break;
+      case 'l':
+        opts.refLines.clear();
+        for (char* p = optarg; *p != '\0';) {
+          long long lines = strtoll(p, &p, 10);
+          if (lines <= 0 || (*p != ',' && *p != '\0')) {
+            bench_usage();
+          }
+          opts.refLines.push_back(lines);
+          if (*p == ',') {
+            ++p;
+          }
+        }
+        break;
+      case 'd':
+        tmpDir = optarg;
+        break;
+      default:
+        bench_usage();
+    }
+  }
+  if (opts.maxThreads <= 0) {
+    bench_usage();
+  }
+
+  using Bench = void (*)(const BenchOpts&);
+  const std::vector<std::pair<std::string, Bench>> benches = {
+    {"hasher", bench_hasher},
+    {"batch", bench_batch},
+    {"queue", bench_queue},
+    {"refdata", bench_refdata},
+    {"add_directory", bench_add_directory}
+  };
+  std::vector<std::string> selected(argv + optind, argv + argc);
+  for (const auto& s : selected) {
+    bool known = false;
+    for (const auto& b : benches) {
+      known = known || b.first == s;
+    }
+    if (!known) {
+      bench_usage();
+    }
+  }
+
+  std::string work = tmpDir + "/micro_bench.XXXXXX";
+  if (mkdtemp(&work[0]) == NULL) {
+    error("failed to create work directory in " + tmpDir);
+  }
+  opts.workDir = work;
+
+  std::cout << "benchmark, parameter, threads, iterations, seconds, rate, unit\n";
+  for (const auto& b : benches) {
+    if (selected.empty() || std::find(selected.begin(), selected.end(),
+        b.first) != selected.end()) {
+      b.second(opts);
+    }
+  }
+  nftw(opts.workDir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
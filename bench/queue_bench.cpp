@@ -0,0 +1,110 @@
+// queue_bench compares the global Pqueue against the work stealing WSqueue
+// on a synthetic tree traversal: every element stands for a directory which
+// expands into fanout children until the requested depth is reached. The
+// per element work is tiny so the benchmark measures queue contention.
+//
+// usage: queue_bench [max threads] [fanout] [depth]
+//
+// (C) Markus Dittrich 2015
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parallel_queue.hpp"
+#include "ws_queue.hpp"
+
+
+// expand returns the children of element s (empty at maximum depth)
+static std::vector<std::string> expand(const std::string& s, int fanout,
+  size_t depth) {
+
+  std::vector<std::string> children;
+  if (s.size() >= depth) {
+    return children;
+  }
+  for (int i = 0; i < fanout; ++i) {
+    children.push_back(s + static_cast<char>('a' + i));
+  }
+  return children;
+}
+
+
+static double run_pqueue(int nthreads, int fanout, size_t depth) {
+  StringQueue queue(nthreads);
+  queue.push("r");
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nthreads; ++i) {
+    threads.push_back(std::thread([&]() {
+      while (!queue.done()) {
+        auto s = queue.try_and_wait();
+        if (s.empty()) {
+          break;
+        }
+        for (auto& c : expand(s, fanout, depth)) {
+          queue.push(c);
+        }
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+static double run_wsqueue(int nthreads, int fanout, size_t depth) {
+  StringWSQueue queue(nthreads);
+  queue.push(0, std::string("r"));
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nthreads; ++i) {
+    threads.push_back(std::thread([&, i]() {
+      std::string s;
+      while (queue.pop(i, s)) {
+        for (auto& c : expand(s, fanout, depth)) {
+          queue.push(i, std::move(c));
+        }
+        queue.task_done();
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+int main(int argc, char** argv) {
+
+  int maxThreads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+  int fanout = argc > 2 ? atoi(argv[2]) : 8;
+  size_t depth = argc > 3 ? atoi(argv[3]) : 7;
+  if (maxThreads <= 0 || fanout <= 0 || depth <= 0) {
+    std::cerr << "usage: queue_bench [max threads] [fanout] [depth]\n";
+    return 1;
+  }
+
+  long long items = 0;
+  long long level = 1;
+  for (size_t d = 0; d < depth; ++d) {
+    items += level;
+    level *= fanout;
+  }
+
+  std::cout << "# elements: " << items << "\n"
+            << "threads, pqueue [items/s], wsqueue [items/s]\n";
+  for (int n = 1; n <= maxThreads; n *= 2) {
+    double tp = run_pqueue(n, fanout, depth);
+    double tw = run_wsqueue(n, fanout, depth);
+    std::cout << n << ", " << items/tp << ", " << items/tw << "\n";
+  }
+}
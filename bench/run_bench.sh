@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# run_bench.sh runs phantom end-to-end on synthetic trees generated by
+# gen_tree and sweeps the number of threads and read modes. Every run
+# appends a csv line to the results file with the columns
+#   revision, profile, read_mode, threads, seconds, files, bytes, files_per_s, mb_per_s
+# so results of different revisions can be tracked and compared.
+#
+# usage: run_bench.sh [-p phantom] [-w work dir] [-o results] [-s scale]
+#                     [-t max threads] [-m read modes] [-r repetitions]
+#                     [-d] [profile ...]
+#
+# By default bench/phantom is timed, which 'make bench' builds optimized and
+# without the sanitizers of the regular debug build.
+# Trees are generated once per work dir and scale and reused by later runs.
+# Runs are made with a warm page cache unless -d is given in which case the
+# cache is dropped before each run (requires root).
+#
+# (C) Markus Dittrich 2015
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+PHANTOM=$BENCH_DIR/phantom
+GEN_TREE=$BENCH_DIR/gen_tree
+WORK_DIR=${TMPDIR:-/tmp}/phantom_bench
+RESULTS=bench_results.csv
+SCALE=1
+MAX_THREADS=$(nproc)
+MODES="async read mmap"
+REPS=3
+DROP_CACHES=0
+
+usage() {
+  echo "usage: run_bench.sh [-p phantom] [-w work dir] [-o results] [-s scale]" >&2
+  echo "                    [-t max threads] [-m read modes] [-r repetitions]" >&2
+  echo "                    [-d] [profile ...]" >&2
+  exit 1
+}
+
+while getopts "p:w:o:s:t:m:r:dh" opt; do
+  case $opt in
+    p) PHANTOM=$OPTARG ;;
+    w) WORK_DIR=$OPTARG ;;
+    o) RESULTS=$OPTARG ;;
+    s) SCALE=$OPTARG ;;
+    t) MAX_THREADS=$OPTARG ;;
+    m) MODES=$OPTARG ;;
+    r) REPS=$OPTARG ;;
+    d) DROP_CACHES=1 ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+PROFILES=${*:-tiny huge deep wide sparse}
+
+for exe in "$PHANTOM" "$GEN_TREE"; do
+  if [ ! -x "$exe" ]; then
+    echo "run_bench.sh: $exe not found; run 'make bench' first" >&2
+    exit 1
+  fi
+done
+
+REVISION=$(git -C "$BENCH_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+if [ ! -s "$RESULTS" ]; then
+  echo "revision, profile, read_mode, threads, seconds, files, bytes, files_per_s, mb_per_s" > "$RESULTS"
+fi
+
+mkdir -p "$WORK_DIR"
+for profile in $PROFILES; do
+  tree=$WORK_DIR/$profile-$SCALE
+  if [ ! -d "$tree" ]; then
+    "$GEN_TREE" "$tree.tmp" "$profile" "$SCALE" | tail -n 1 > "$tree.info"
+    mv "$tree.tmp" "$tree"
+  fi
+  files=$(cut -d, -f2 "$tree.info" | tr -d ' ')
+  bytes=$(cut -d, -f4 "$tree.info" | tr -d ' ')
+
+  for mode in $MODES; do
+    threads=1
+    while [ "$threads" -le "$MAX_THREADS" ]; do
+      for ((rep = 0; rep < REPS; ++rep)); do
+        if [ "$DROP_CACHES" -eq 1 ]; then
+          sync
+          echo 3 > /proc/sys/vm/drop_caches
+        fi
+        start=$(date +%s%N)
+        "$PHANTOM" -n "$threads" -r "$mode" "$tree" > /dev/null
+        end=$(date +%s%N)
+        awk -v rev="$REVISION" -v p="$profile" -v m="$mode" -v t="$threads" \
+          -v ns=$((end - start)) -v f="$files" -v b="$bytes" 'BEGIN {
+            s = ns / 1e9
+            printf "%s, %s, %s, %d, %.4f, %d, %d, %.1f, %.2f\n",
+              rev, p, m, t, s, f, b, f / s, b / s / 1048576
+          }' | tee -a "$RESULTS"
+      done
+      threads=$((threads * 2))
+    done
+  done
+done
@@ -0,0 +1,95 @@
+#!/bin/bash
+#
+# run_shards.sh splits a scan of a tree into N shards run as parallel
+# phantom processes on this machine, merges their manifests and checks the
+# result against a single process scan. It also reports how evenly files
+# were spread over the shards and the wall clock times of both scans.
+#
+# usage: run_shards.sh [-p phantom] [-n shards] [-j shard depth]
+#                      [-t threads per shard] [-w work dir] <tree>
+#
+# The merged manifest is additionally compared against the single process
+# manifest via phantom --merge --compare which has to report no differences.
+#
+# (C) Markus Dittrich 2015
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+PHANTOM=$BENCH_DIR/phantom
+SHARDS=4
+DEPTH=1
+THREADS=1
+WORK_DIR=${TMPDIR:-/tmp}/phantom_shards
+
+usage() {
+  echo "usage: run_shards.sh [-p phantom] [-n shards] [-j shard depth]" >&2
+  echo "                     [-t threads per shard] [-w work dir] <tree>" >&2
+  exit 1
+}
+
+while getopts "p:n:j:t:w:h" opt; do
+  case $opt in
+    p) PHANTOM=$OPTARG ;;
+    n) SHARDS=$OPTARG ;;
+    j) DEPTH=$OPTARG ;;
+    t) THREADS=$OPTARG ;;
+    w) WORK_DIR=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+if [ $# -ne 1 ]; then
+  usage
+fi
+TREE=$1
+
+if [ ! -x "$PHANTOM" ]; then
+  echo "run_shards.sh: $PHANTOM not found; run 'make bench' first" >&2
+  exit 1
+fi
+
+rm -rf "$WORK_DIR"
+mkdir -p "$WORK_DIR"
+
+start=$(date +%s%N)
+"$PHANTOM" -n "$THREADS" -O "$TREE" > "$WORK_DIR/single.txt"
+end=$(date +%s%N)
+single_ns=$((end - start))
+
+start=$(date +%s%N)
+pids=()
+for ((i = 0; i < SHARDS; ++i)); do
+  "$PHANTOM" -n "$THREADS" -K "$i/$SHARDS" -j "$DEPTH" "$TREE" \
+    > "$WORK_DIR/shard-$i.txt" &
+  pids+=($!)
+done
+for pid in "${pids[@]}"; do
+  wait "$pid"
+done
+manifests=()
+for ((i = 0; i < SHARDS; ++i)); do
+  manifests+=("$WORK_DIR/shard-$i.txt")
+done
+"$PHANTOM" -M "${manifests[@]}" > "$WORK_DIR/merged.txt"
+end=$(date +%s%N)
+sharded_ns=$((end - start))
+
+for ((i = 0; i < SHARDS; ++i)); do
+  echo "shard $i/$SHARDS: $(wc -l < "$WORK_DIR/shard-$i.txt") files"
+done
+awk -v s="$single_ns" -v m="$sharded_ns" 'BEGIN {
+  printf "single: %.3f s, sharded (incl. merge): %.3f s\n", s / 1e9, m / 1e9
+}'
+
+if ! cmp -s "$WORK_DIR/single.txt" "$WORK_DIR/merged.txt"; then
+  echo "run_shards.sh: merged manifest differs from the single process scan" >&2
+  exit 1
+fi
+report=$("$PHANTOM" -M -c "$WORK_DIR/single.txt" "${manifests[@]}")
+if [ -n "$report" ]; then
+  echo "$report" >&2
+  echo "run_shards.sh: merged compare report is not empty" >&2
+  exit 1
+fi
+echo "merged manifest matches the single process scan"
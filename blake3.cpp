@@ -0,0 +1,441 @@
+// this file implements the BLAKE3 hash following the reference specification
+// at https://github.com/BLAKE3-team/BLAKE3-specs
+//
+// Full 1 KB chunks are hashed several at a time by a vectorized kernel which
+// keeps one chunk per vector lane. The kernel is written once with gcc vector
+// extensions and instantiated for SSE2 (4 lanes), AVX2 (8 lanes) and AVX-512
+// (16 lanes); the widest one supported by the CPU is picked at runtime.
+//
+// (C) Markus Dittrich, 2015
+
+#include <algorithm>
+#include <cstring>
+
+#include "fast_digest.hpp"
+#include "multi_buffer.hpp"
+
+
+static const uint32_t iv[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+  0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const int msgPermutation[16] = {
+  2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8
+};
+
+static const uint32_t chunkStart = 1 << 0;
+static const uint32_t chunkEnd = 1 << 1;
+static const uint32_t parent = 1 << 2;
+static const uint32_t root = 1 << 3;
+
+static const size_t blockLen = 64;
+static const size_t chunkLen = 1024;
+
+
+// HashChunksFunc computes the chaining values of degree consecutive full
+// chunks at input starting at chunk counter
+using HashChunksFunc = void (*)(const unsigned char* input, uint64_t counter,
+  uint32_t* cvs);
+
+struct ChunksKernel {
+  HashChunksFunc func;
+  size_t degree;
+  const char* name;
+};
+
+static ChunksKernel select_kernel();
+static const ChunksKernel kernel = select_kernel();
+
+
+static inline uint32_t load32(const unsigned char* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8
+    | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+
+static inline uint32_t rotr(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+
+static inline void g(uint32_t* v, int a, int b, int c, int d, uint32_t mx,
+  uint32_t my) {
+  v[a] = v[a] + v[b] + mx;
+  v[d] = rotr(v[d] ^ v[a], 16);
+  v[c] = v[c] + v[d];
+  v[b] = rotr(v[b] ^ v[c], 12);
+  v[a] = v[a] + v[b] + my;
+  v[d] = rotr(v[d] ^ v[a], 8);
+  v[c] = v[c] + v[d];
+  v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+
+// compress runs the BLAKE3 compression function and returns the full 16 word
+// output in out
+static void compress(const uint32_t cv[8], const uint32_t block[16],
+  uint64_t counter, uint32_t len, uint32_t flags, uint32_t out[16]) {
+
+  uint32_t v[16] = {
+    cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+    iv[0], iv[1], iv[2], iv[3],
+    static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32),
+    len, flags
+  };
+  uint32_t m[16];
+  memcpy(m, block, sizeof(m));
+
+  for (int r = 0; r < 7; ++r) {
+    g(v, 0, 4, 8, 12, m[0], m[1]);
+    g(v, 1, 5, 9, 13, m[2], m[3]);
+    g(v, 2, 6, 10, 14, m[4], m[5]);
+    g(v, 3, 7, 11, 15, m[6], m[7]);
+    g(v, 0, 5, 10, 15, m[8], m[9]);
+    g(v, 1, 6, 11, 12, m[10], m[11]);
+    g(v, 2, 7, 8, 13, m[12], m[13]);
+    g(v, 3, 4, 9, 14, m[14], m[15]);
+
+    uint32_t permuted[16];
+    for (int i = 0; i < 16; ++i) {
+      permuted[i] = m[msgPermutation[i]];
+    }
+    memcpy(m, permuted, sizeof(m));
+  }
+
+  for (int i = 0; i < 8; ++i) {
+    out[i] = v[i] ^ v[i+8];
+    out[i+8] = v[i+8] ^ cv[i];
+  }
+}
+
+
+// hash_chunks_portable hashes a single full chunk with the scalar
+// compression function
+static void hash_chunks_portable(const unsigned char* input, uint64_t counter,
+  uint32_t* cvs) {
+
+  uint32_t cv[8];
+  memcpy(cv, iv, sizeof(cv));
+  for (size_t b = 0; b < chunkLen / blockLen; ++b) {
+    uint32_t block[16];
+    for (int w = 0; w < 16; ++w) {
+      block[w] = load32(input + b*blockLen + 4*w);
+    }
+    uint32_t flags = (b == 0 ? chunkStart : 0)
+      | (b == chunkLen / blockLen - 1 ? chunkEnd : 0);
+    uint32_t out[16];
+    compress(cv, block, counter, blockLen, flags, out);
+    memcpy(cv, out, sizeof(cv));
+  }
+  memcpy(cvs, cv, sizeof(cv));
+}
+
+
+#if defined(__x86_64__)
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+template <typename V>
+static ALWAYS_INLINE void rotr_vec(V& x, int n) {
+  x = (x >> n) | (x << (32 - n));
+}
+
+
+template <typename V>
+static ALWAYS_INLINE void g_vec(V* v, int a, int b, int c, int d,
+  const V& mx, const V& my) {
+  v[a] = v[a] + v[b] + mx;
+  v[d] ^= v[a];
+  rotr_vec(v[d], 16);
+  v[c] = v[c] + v[d];
+  v[b] ^= v[c];
+  rotr_vec(v[b], 12);
+  v[a] = v[a] + v[b] + my;
+  v[d] ^= v[a];
+  rotr_vec(v[d], 8);
+  v[c] = v[c] + v[d];
+  v[b] ^= v[c];
+  rotr_vec(v[b], 7);
+}
+
+
+template <typename V, int N>
+static ALWAYS_INLINE void splat(V& x, uint32_t s) {
+  for (int l = 0; l < N; ++l) {
+    x[l] = s;
+  }
+}
+
+
+// hash_chunks_vec hashes N full chunks in parallel, one chunk per lane of
+// the vector type V
+template <typename V, int N>
+static ALWAYS_INLINE void hash_chunks_vec(const unsigned char* input,
+  uint64_t counter, uint32_t* cvs) {
+
+  V h[8];
+  for (int i = 0; i < 8; ++i) {
+    splat<V, N>(h[i], iv[i]);
+  }
+  V counterLo, counterHi;
+  for (int l = 0; l < N; ++l) {
+    counterLo[l] = static_cast<uint32_t>(counter + l);
+    counterHi[l] = static_cast<uint32_t>((counter + l) >> 32);
+  }
+
+  for (size_t b = 0; b < chunkLen / blockLen; ++b) {
+    V m[16];
+    for (int w = 0; w < 16; ++w) {
+      for (int l = 0; l < N; ++l) {
+        m[w][l] = load32(input + l*chunkLen + b*blockLen + 4*w);
+      }
+    }
+    uint32_t flags = (b == 0 ? chunkStart : 0)
+      | (b == chunkLen / blockLen - 1 ? chunkEnd : 0);
+
+    V v[16];
+    for (int i = 0; i < 8; ++i) {
+      v[i] = h[i];
+    }
+    for (int i = 0; i < 4; ++i) {
+      splat<V, N>(v[8+i], iv[i]);
+    }
+    v[12] = counterLo;
+    v[13] = counterHi;
+    splat<V, N>(v[14], blockLen);
+    splat<V, N>(v[15], flags);
+
+    for (int r = 0; r < 7; ++r) {
+      g_vec(v, 0, 4, 8, 12, m[0], m[1]);
+      g_vec(v, 1, 5, 9, 13, m[2], m[3]);
+      g_vec(v, 2, 6, 10, 14, m[4], m[5]);
+      g_vec(v, 3, 7, 11, 15, m[6], m[7]);
+      g_vec(v, 0, 5, 10, 15, m[8], m[9]);
+      g_vec(v, 1, 6, 11, 12, m[10], m[11]);
+      g_vec(v, 2, 7, 8, 13, m[12], m[13]);
+      g_vec(v, 3, 4, 9, 14, m[14], m[15]);
+
+      V permuted[16];
+      for (int i = 0; i < 16; ++i) {
+        permuted[i] = m[msgPermutation[i]];
+      }
+      for (int i = 0; i < 16; ++i) {
+        m[i] = permuted[i];
+      }
+    }
+
+    for (int i = 0; i < 8; ++i) {
+      h[i] = v[i] ^ v[i+8];
+    }
+  }
+
+  for (int i = 0; i < 8; ++i) {
+    for (int l = 0; l < N; ++l) {
+      cvs[l*8 + i] = h[i][l];
+    }
+  }
+}
+
+
+static void hash_chunks_sse2(const unsigned char* input, uint64_t counter,
+  uint32_t* cvs) {
+  hash_chunks_vec<u32x4, 4>(input, counter, cvs);
+}
+
+
+__attribute__((target("avx2")))
+static void hash_chunks_avx2(const unsigned char* input, uint64_t counter,
+  uint32_t* cvs) {
+  hash_chunks_vec<u32x8, 8>(input, counter, cvs);
+}
+
+
+__attribute__((target("avx512f")))
+static void hash_chunks_avx512(const unsigned char* input, uint64_t counter,
+  uint32_t* cvs) {
+  hash_chunks_vec<u32x16, 16>(input, counter, cvs);
+}
+#endif
+
+
+// select_kernel picks the widest multi-chunk kernel supported by the CPU
+static ChunksKernel select_kernel() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {hash_chunks_avx512, 16, "avx512"};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return {hash_chunks_avx2, 8, "avx2"};
+  }
+  return {hash_chunks_sse2, 4, "sse2"};
+#else
+  return {hash_chunks_portable, 1, "portable"};
+#endif
+}
+
+
+// name of the implementation selected for this CPU
+const char* Blake3Digest::implementation() {
+  return kernel.name;
+}
+
+
+Blake3Digest::Blake3Digest() {
+  reset_chunk(0);
+}
+
+
+void Blake3Digest::reset() {
+  reset_chunk(0);
+  cvStack_.clear();
+}
+
+
+void Blake3Digest::update(const char* buf, size_t size) {
+  auto input = reinterpret_cast<const unsigned char*>(buf);
+
+  // top up a partially filled chunk first. A full chunk is only finished
+  // once more input arrives since the last chunk needs the root flag.
+  if (blockLen_ > 0 || blocksCompressed_ > 0) {
+    size_t have = blocksCompressed_ * blockLen + blockLen_;
+    size_t n = std::min(size, chunkLen - have);
+    chunk_update(input, n);
+    input += n;
+    size -= n;
+    if (size == 0) {
+      return;
+    }
+    uint32_t out[16];
+    Output o = chunk_output();
+    compress(o.cv, o.block, o.counter, o.blockLen, o.flags, out);
+    push_cv(out, chunkCounter_ + 1);
+    reset_chunk(chunkCounter_ + 1);
+  }
+
+  // hash batches of full chunks with the vectorized kernel
+  uint32_t cvs[16*8];
+  while (size > kernel.degree * chunkLen) {
+    kernel.func(input, chunkCounter_, cvs);
+    for (size_t i = 0; i < kernel.degree; ++i) {
+      push_cv(cvs + 8*i, chunkCounter_ + i + 1);
+    }
+    reset_chunk(chunkCounter_ + kernel.degree);
+    input += kernel.degree * chunkLen;
+    size -= kernel.degree * chunkLen;
+  }
+
+  // remaining full chunks one at a time
+  while (size > chunkLen) {
+    hash_chunks_portable(input, chunkCounter_, cvs);
+    push_cv(cvs, chunkCounter_ + 1);
+    reset_chunk(chunkCounter_ + 1);
+    input += chunkLen;
+    size -= chunkLen;
+  }
+  chunk_update(input, size);
+}
+
+
+std::string Blake3Digest::final() {
+  Output o = chunk_output();
+  uint32_t out[16];
+  for (size_t n = cvStack_.size() / 8; n > 0; --n) {
+    compress(o.cv, o.block, o.counter, o.blockLen, o.flags, out);
+    memcpy(o.block, &cvStack_[(n-1)*8], 8*sizeof(uint32_t));
+    memcpy(o.block + 8, out, 8*sizeof(uint32_t));
+    memcpy(o.cv, iv, sizeof(o.cv));
+    o.counter = 0;
+    o.blockLen = blockLen;
+    o.flags = parent;
+  }
+  compress(o.cv, o.block, 0, o.blockLen, o.flags | root, out);
+
+  unsigned char digest[32];
+  for (int i = 0; i < 8; ++i) {
+    for (int k = 0; k < 4; ++k) {
+      digest[4*i + k] = static_cast<unsigned char>(out[i] >> (8*k));
+    }
+  }
+  return to_hex(digest, sizeof(digest));
+}
+
+
+// chunk_update adds size bytes of input to the current chunk. The last
+// block is kept uncompressed until more input arrives.
+void Blake3Digest::chunk_update(const unsigned char* input, size_t size) {
+  while (size > 0) {
+    if (blockLen_ == blockLen) {
+      uint32_t block[16];
+      for (int w = 0; w < 16; ++w) {
+        block[w] = load32(block_ + 4*w);
+      }
+      uint32_t out[16];
+      compress(chunkCv_, block, chunkCounter_, blockLen,
+        blocksCompressed_ == 0 ? chunkStart : 0, out);
+      memcpy(chunkCv_, out, sizeof(chunkCv_));
+      ++blocksCompressed_;
+      blockLen_ = 0;
+    }
+    size_t n = std::min(size, blockLen - blockLen_);
+    memcpy(block_ + blockLen_, input, n);
+    blockLen_ += n;
+    input += n;
+    size -= n;
+  }
+}
+
+
+// chunk_output returns the compression input of the last block of the
+// current chunk
+Blake3Digest::Output Blake3Digest::chunk_output() const {
+  Output o;
+  memcpy(o.cv, chunkCv_, sizeof(o.cv));
+  unsigned char padded[blockLen] = {0};
+  memcpy(padded, block_, blockLen_);
+  for (int w = 0; w < 16; ++w) {
+    o.block[w] = load32(padded + 4*w);
+  }
+  o.counter = chunkCounter_;
+  o.blockLen = blockLen_;
+  o.flags = (blocksCompressed_ == 0 ? chunkStart : 0) | chunkEnd;
+  return o;
+}
+
+
+void Blake3Digest::reset_chunk(uint64_t counter) {
+  memcpy(chunkCv_, iv, sizeof(chunkCv_));
+  chunkCounter_ = counter;
+  blockLen_ = 0;
+  blocksCompressed_ = 0;
+}
+
+
+// push_cv adds the chaining value of a completed chunk to the tree, merging
+// completed subtrees; totalChunks is the number of chunks hashed so far
+void Blake3Digest::push_cv(const uint32_t cv[8], uint64_t totalChunks) {
+  uint32_t block[16];
+  memcpy(block + 8, cv, 8*sizeof(uint32_t));
+  while ((totalChunks & 1) == 0) {
+    memcpy(block, &cvStack_[cvStack_.size() - 8], 8*sizeof(uint32_t));
+    cvStack_.resize(cvStack_.size() - 8);
+    uint32_t out[16];
+    compress(iv, block, 0, blockLen, parent, out);
+    memcpy(block + 8, out, 8*sizeof(uint32_t));
+    totalChunks >>= 1;
+  }
+  cvStack_.insert(cvStack_.end(), block + 8, block + 16);
+}
+
+
+// fast_digest_implementations returns a human readable summary of the
+// implementations selected for this CPU
+std::string fast_digest_implementations() {
+  return std::string("crc32c=") + Crc32cDigest::implementation()
+    + " blake3=" + Blake3Digest::implementation()
+    + " multi-buffer md5/sha1=" + multi_buffer_implementation();
+}
@@ -0,0 +1,167 @@
+// Bqueue is a bounded, closable multi producer multi consumer queue used to
+// connect the stages of phantom's pipeline. Producers block while the queue
+// is full and consumers block while it is empty; the time spent blocked as
+// well as the queue depth are recorded so stages can be sized.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+
+// default capacity of the queues connecting pipeline stages
+const size_t defaultStageQueueSize = 4096;
+
+
+// QueueStats summarizes depth and stall times of a Bqueue
+struct QueueStats {
+  std::string name;
+  size_t capacity = 0;
+  size_t max_depth = 0;
+  double avg_depth = 0;
+  std::chrono::nanoseconds push_stall{0};  // time producers waited on a full queue
+  std::chrono::nanoseconds pop_stall{0};   // time consumers waited on an empty queue
+};
+
+
+template <typename T>
+class Bqueue {
+
+public:
+
+  using size_type = typename std::deque<T>::size_type;
+
+  Bqueue(const std::string& name, size_type capacity)
+    : name_(name), capacity_(capacity) {};
+
+  Bqueue(const Bqueue& bq) = delete;
+  Bqueue& operator=(const Bqueue& bq) = delete;
+
+  size_type size() const {
+    std::lock_guard<std::mutex> lg(mx_);
+    return queue_.size();
+  }
+
+  // pushed returns the number of elements pushed so far
+  unsigned long long pushed() const {
+    std::lock_guard<std::mutex> lg(mx_);
+    return num_pushes_;
+  }
+
+  // push moves elem into the queue, waiting for room if necessary
+  void push(T&& elem) {
+    std::unique_lock<std::mutex> ul(mx_);
+    if (queue_.size() >= capacity_) {
+      auto start = std::chrono::steady_clock::now();
+      not_full_.wait(ul, [this]() { return queue_.size() < capacity_; });
+      push_stall_ += std::chrono::steady_clock::now() - start;
+    }
+    queue_.push_back(std::move(elem));
+    if (queue_.size() > max_depth_) {
+      max_depth_ = queue_.size();
+    }
+    depth_sum_ += queue_.size();
+    ++num_pushes_;
+    not_empty_.notify_one();
+  }
+
+  // try_push moves elem into the queue if there is room. Returns false (and
+  // leaves elem alone) if the queue is full.
+  bool try_push(T& elem) {
+    std::lock_guard<std::mutex> lg(mx_);
+    if (queue_.size() >= capacity_) {
+      return false;
+    }
+    queue_.push_back(std::move(elem));
+    if (queue_.size() > max_depth_) {
+      max_depth_ = queue_.size();
+    }
+    depth_sum_ += queue_.size();
+    ++num_pushes_;
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // pop moves the next element into elem, waiting if the queue is empty.
+  // Returns false once the queue is closed and drained.
+  bool pop(T& elem) {
+    std::unique_lock<std::mutex> ul(mx_);
+    if (queue_.empty() && !closed_) {
+      auto start = std::chrono::steady_clock::now();
+      not_empty_.wait(ul, [this]() { return !queue_.empty() || closed_; });
+      pop_stall_ += std::chrono::steady_clock::now() - start;
+    }
+    if (queue_.empty()) {
+      return false;
+    }
+    elem = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // try_pop moves the next element into elem if one is available
+  bool try_pop(T& elem) {
+    std::lock_guard<std::mutex> lg(mx_);
+    if (queue_.empty()) {
+      return false;
+    }
+    elem = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // drained returns true once the queue is closed and empty
+  bool drained() const {
+    std::lock_guard<std::mutex> lg(mx_);
+    return closed_ && queue_.empty();
+  }
+
+  // close signals that no more elements will be pushed
+  void close() {
+    std::lock_guard<std::mutex> lg(mx_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+  QueueStats stats() const {
+    std::lock_guard<std::mutex> lg(mx_);
+    QueueStats qs;
+    qs.name = name_;
+    qs.capacity = capacity_;
+    qs.max_depth = max_depth_;
+    qs.avg_depth = num_pushes_ > 0 ? static_cast<double>(depth_sum_)/num_pushes_ : 0;
+    qs.push_stall = push_stall_;
+    qs.pop_stall = pop_stall_;
+    return qs;
+  }
+
+private:
+
+  std::string name_;
+  std::deque<T> queue_;
+  size_type capacity_;
+  bool closed_ = false;
+
+  mutable std::mutex mx_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+
+  // depth and stall statistics
+  size_type max_depth_ = 0;
+  unsigned long long depth_sum_ = 0;
+  unsigned long long num_pushes_ = 0;
+  std::chrono::nanoseconds push_stall_{0};
+  std::chrono::nanoseconds pop_stall_{0};
+};
+
+using StringBQueue = Bqueue<std::string>;
+
+#endif
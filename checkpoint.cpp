@@ -0,0 +1,199 @@
+// this file implements checkpointing of long running scans
+//
+// (C) Markus Dittrich 2015
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "checkpoint.hpp"
+#include "output.hpp"
+#include "util.hpp"
+
+
+// deadline in ns since the steady clock epoch (0 if there is none)
+static std::atomic<long long> deadline{0};
+static std::atomic<bool> stopped{false};
+
+// size of pending journal output that triggers a write (without sync)
+static const size_t journalWriteSize = 1024*1024;
+
+
+static long long steady_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// set_time_budget makes stop_requested return true once seconds have passed
+void set_time_budget(double seconds) {
+  deadline = steady_ns() + static_cast<long long>(seconds * 1e9);
+}
+
+
+// stop_requested returns true once the time budget is used up
+bool stop_requested() {
+  if (stopped.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  long long d = deadline.load(std::memory_order_relaxed);
+  if (d != 0 && steady_ns() >= d) {
+    stopped = true;
+  }
+  return stopped.load(std::memory_order_relaxed);
+}
+
+
+// scan_stopped returns true if stop_requested returned true at least once
+bool scan_stopped() {
+  return stopped;
+}
+
+
+Checkpoint::~Checkpoint() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+
+// open opens the journal at path. A crash may have left a partial last
+// line which is cut off before the journal is loaded.
+void Checkpoint::open(const std::string& path, bool resume,
+  const std::string& method, double interval) {
+
+  path_ = path;
+  method_ = method;
+  interval_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(interval));
+  lastSync_ = std::chrono::steady_clock::now();
+
+  int flags = O_WRONLY | O_CREAT | (resume ? O_APPEND : O_TRUNC);
+  fd_ = ::open(path.c_str(), flags, 0644);
+  if (fd_ < 0) {
+    throw std::runtime_error("failed to open checkpoint journal " + path + ": "
+      + strerror(errno));
+  }
+  if (!resume) {
+    return;
+  }
+
+  struct stat info;
+  if (fstat(fd_, &info) < 0) {
+    throw std::runtime_error("failed to stat checkpoint journal " + path);
+  }
+  if (info.st_size == 0) {
+    return;
+  }
+  int rfd = ::open(path.c_str(), O_RDONLY);
+  if (rfd < 0) {
+    throw std::runtime_error("failed to read checkpoint journal " + path);
+  }
+  off_t end = info.st_size;
+  char c = 0;
+  while (end > 0 && pread(rfd, &c, 1, end - 1) == 1 && c != '\n') {
+    --end;
+  }
+  ::close(rfd);
+  if (end < info.st_size && ftruncate(fd_, end) < 0) {
+    throw std::runtime_error("failed to truncate checkpoint journal " + path);
+  }
+  if (end == 0) {
+    return;
+  }
+
+  // malformed lines only cost rehashing their file so they are skipped
+  std::ifstream journal(path);
+  if (!journal) {
+    throw std::runtime_error("failed to read checkpoint journal " + path);
+  }
+  RefDbBuilder builder;
+  std::string line;
+  std::string file;
+  RefEntry entry;
+  size_t skipped = 0;
+  while (getline(journal, line)) {
+    if (!parse_reference_line(line, file, entry) || !builder.add(file, entry)) {
+      ++skipped;
+    }
+  }
+  if (skipped > 0) {
+    std::cerr << "skipped " << skipped << " malformed lines of checkpoint journal "
+      << path << "\n";
+  }
+  if (builder.size() > 0) {
+    done_ = builder.build();
+  }
+}
+
+
+// finished returns true if path with meta was hashed by a previous run
+bool Checkpoint::finished(const std::string& path, const FileMeta& meta,
+  std::string& hash) const {
+
+  auto i = done_.find(path);
+  if (i == RefDb::npos || !done_.has_meta(i) || !(done_.meta(i) == meta)
+    || done_.method(i) != method_) {
+    return false;
+  }
+  hash = done_.hash(i);
+  return true;
+}
+
+
+// add records the finished result of path
+void Checkpoint::add(const std::string& path, const std::string& hash,
+  const FileMeta& meta) {
+
+  std::lock_guard<std::mutex> lg(mx_);
+  buf_.append(method_).append(" , ").append(path).append(" , ").append(hash)
+    .append(" , ");
+  append_meta(buf_, meta);
+  buf_.push_back('\n');
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastSync_ >= interval_) {
+    flush(true);
+    lastSync_ = now;
+  } else if (buf_.size() >= journalWriteSize) {
+    flush(false);
+  }
+}
+
+
+// close writes out and syncs all pending results
+void Checkpoint::close() {
+  std::lock_guard<std::mutex> lg(mx_);
+  if (fd_ >= 0) {
+    flush(true);
+  }
+}
+
+
+// flush writes the pending results to the journal and optionally syncs it.
+// Must be called with mx_ held. Since flushing happens on the hash threads
+// failures are fatal.
+void Checkpoint::flush(bool sync) {
+  size_t done = 0;
+  while (done < buf_.size()) {
+    ssize_t n = write(fd_, buf_.data() + done, buf_.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      error("failed to write checkpoint journal " + path_ + ": "
+        + strerror(errno));
+    }
+    done += n;
+  }
+  buf_.clear();
+  if (sync && fdatasync(fd_) < 0) {
+    error("failed to sync checkpoint journal " + path_);
+  }
+}
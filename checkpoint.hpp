@@ -0,0 +1,95 @@
+// this file implements checkpointing of long running scans. Finished
+// results are appended to a journal in phantom's text output format which
+// is synced to disk periodically. When resuming, the journal is loaded and
+// files whose path and metadata (size, mtime, ctime, inode, device) match
+// a journal entry take the journaled hash instead of being rehashed. The
+// tree itself is walked again, which only costs metadata operations, so
+// outstanding work never has to be recorded.
+// A scan can also be given a time budget after which walkers and hash
+// threads stop cleanly so the run can be resumed later.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "refdb.hpp"
+
+
+// default interval between journal syncs in seconds
+const double defaultCheckpointInterval = 30;
+
+
+// set_time_budget makes stop_requested return true once seconds have passed
+void set_time_budget(double seconds);
+
+
+// stop_requested returns true once the time budget is used up. Callers
+// skip their remaining work when it does.
+bool stop_requested();
+
+
+// scan_stopped returns true if stop_requested returned true at least once,
+// i.e. the scan skipped work and is incomplete
+bool scan_stopped();
+
+
+// Checkpoint manages the journal of finished results
+class Checkpoint {
+
+public:
+
+  Checkpoint() = default;
+  ~Checkpoint();
+
+  Checkpoint(const Checkpoint& c) = delete;
+  Checkpoint& operator=(const Checkpoint& c) = delete;
+
+  // open opens the journal at path for results hashed with method. If
+  // resume is set, the results of an existing journal are loaded and new
+  // ones appended, otherwise the journal is started from scratch. Throws
+  // std::runtime_error on failure.
+  void open(const std::string& path, bool resume, const std::string& method,
+    double interval);
+
+  bool enabled() const {
+    return fd_ >= 0;
+  }
+
+  // num_loaded returns the number of results loaded from the journal
+  size_t num_loaded() const {
+    return done_.size();
+  }
+
+  // finished returns true if path with meta was hashed by a previous run
+  // and sets hash to the journaled hash
+  bool finished(const std::string& path, const FileMeta& meta,
+    std::string& hash) const;
+
+  // add records the finished result of path. The journal is synced once
+  // the checkpoint interval has passed.
+  void add(const std::string& path, const std::string& hash,
+    const FileMeta& meta);
+
+  // close writes out and syncs all pending results
+  void close();
+
+private:
+
+  void flush(bool sync);
+
+  std::string path_;
+  std::string method_;
+  int fd_ = -1;
+  RefDb done_;
+  std::chrono::steady_clock::duration interval_;
+  std::chrono::steady_clock::time_point lastSync_;
+  std::mutex mx_;   // protects buf_ and lastSync_
+  std::string buf_;
+};
+
+#endif
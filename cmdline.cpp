@@ -3,19 +3,53 @@
 // (C) Markus Dittrich, 2015
 
 #include <getopt.h>
+#include <stdlib.h>
 
 #include <iostream>
 
 #include "cmdline.hpp"
+#include "hash.hpp"
 #include "util.hpp"
 
 
+static std::vector<std::string> parse_digest_list(const std::string& list);
+
+
 // long_options for getopt_long command line parsing
 static struct option long_options[] = {
   {"num_threads", required_argument, NULL, 'n'},
+  {"walk_threads", required_argument, NULL, 'w'},
+  {"hash_threads", required_argument, NULL, 'H'},
+  {"tree_threads", required_argument, NULL, 'T'},
   {"compare", required_argument, NULL, 'c'},
   {"digest", required_argument, NULL, 'd'},
   {"collect_stats", no_argument, NULL, 's'},
+  {"read_mode", required_argument, NULL, 'r'},
+  {"buffer_size", required_argument, NULL, 'b'},
+  {"queue_depth", required_argument, NULL, 'q'},
+  {"batch_size", required_argument, NULL, 'B'},
+  {"elevator", required_argument, NULL, 'e'},
+  {"elevator_window", required_argument, NULL, 'W'},
+  {"device_threads", required_argument, NULL, 'D'},
+  {"incremental", no_argument, NULL, 'i'},
+  {"paranoid", required_argument, NULL, 'p'},
+  {"output_db", required_argument, NULL, 'o'},
+  {"convert", required_argument, NULL, 'C'},
+  {"streaming", no_argument, NULL, 'S'},
+  {"tmp_dir", required_argument, NULL, 't'},
+  {"sorted", no_argument, NULL, 'O'},
+  {"duplicates", no_argument, NULL, 'u'},
+  {"verify", no_argument, NULL, 'V'},
+  {"checkpoint", required_argument, NULL, 'k'},
+  {"resume", no_argument, NULL, 'R'},
+  {"checkpoint_interval", required_argument, NULL, 'I'},
+  {"time_budget", required_argument, NULL, 'L'},
+  {"shard", required_argument, NULL, 'K'},
+  {"shard_depth", required_argument, NULL, 'j'},
+  {"merge", no_argument, NULL, 'M'},
+  {"progress", required_argument, NULL, 'P'},
+  {"status_file", required_argument, NULL, 'F'},
+  {"trace", required_argument, NULL, 'x'},
   {"help", no_argument, NULL, 'h'},
   {NULL, 0, NULL, 0}
 };
@@ -29,7 +63,11 @@ struct CmdLineOpts parse_cmdline(int argc, char** argv) {
 
   int c;
   long nthreads;
-  while ((c = getopt_long (argc, argv, "n:c:d:sh", long_options, NULL)) != -1) {
+  long bufSize;
+  long depth;
+  long batchSize;
+  long window;
+  while ((c = getopt_long (argc, argv, "n:w:H:T:c:d:sr:b:q:B:e:W:D:ip:o:C:St:OuVk:RI:L:K:j:MP:F:x:h", long_options, NULL)) != -1) {
 
     switch(c) {
       case 'n':
@@ -40,6 +78,30 @@ struct CmdLineOpts parse_cmdline(int argc, char** argv) {
         cmdOpts.numThreads = nthreads;
         break;
 
+      case 'w':
+        nthreads = strtol(optarg, NULL, 10);
+        if (nthreads <= 0) {
+          error("incorrect number of walker threads specified on command line");
+        }
+        cmdOpts.walkThreads = nthreads;
+        break;
+
+      case 'H':
+        nthreads = strtol(optarg, NULL, 10);
+        if (nthreads <= 0) {
+          error("incorrect number of hash threads specified on command line");
+        }
+        cmdOpts.hashThreads = nthreads;
+        break;
+
+      case 'T':
+        nthreads = strtol(optarg, NULL, 10);
+        if (nthreads <= 0) {
+          error("incorrect number of tree digest threads specified on command line");
+        }
+        cmdOpts.treeThreads = nthreads;
+        break;
+
       case 'c':
         cmdOpts.compareToRef = true;
         cmdOpts.referenceFilePath = optarg;
@@ -50,23 +112,264 @@ struct CmdLineOpts parse_cmdline(int argc, char** argv) {
         break;
 
       case 'd':
-        cmdOpts.hashMethod = optarg;
-        if (cmdOpts.hashMethod != "md5" && cmdOpts.hashMethod != "sha1"
-            && cmdOpts.hashMethod != "ripemd160") {
-          error("unknown hash method.");
+        cmdOpts.digests = parse_digest_list(optarg);
+        cmdOpts.hashMethod = join_digests(cmdOpts.digests);
+        break;
+
+      case 'r':
+        cmdOpts.readMode = optarg;
+        if (!is_read_mode(cmdOpts.readMode)) {
+          error("unknown read mode.");
+        }
+        break;
+
+      case 'b':
+        bufSize = strtol(optarg, NULL, 10);
+        if (bufSize <= 0) {
+          error("incorrect buffer size specified on command line");
+        }
+        cmdOpts.bufferSize = bufSize * 1024;
+        break;
+
+      case 'q':
+        depth = strtol(optarg, NULL, 10);
+        if (depth <= 0) {
+          error("incorrect queue depth specified on command line");
+        }
+        cmdOpts.queueDepth = depth;
+        break;
+
+      case 'B':
+        batchSize = strtol(optarg, NULL, 10);
+        if (batchSize < 0) {
+          error("incorrect batch size specified on command line");
+        }
+        cmdOpts.batchSize = batchSize;
+        break;
+
+      case 'e':
+        cmdOpts.elevator = optarg;
+        if (!is_elevator_mode(cmdOpts.elevator)) {
+          error("unknown elevator mode.");
+        }
+        break;
+
+      case 'W':
+        window = strtol(optarg, NULL, 10);
+        if (window <= 0) {
+          error("incorrect elevator window specified on command line");
+        }
+        cmdOpts.elevatorWindow = window;
+        break;
+
+      case 'D':
+        cmdOpts.deviceGroups = true;
+        if (!parse_device_limits(optarg, cmdOpts.deviceLimits)) {
+          error("incorrect device threads specified on command line");
+        }
+        break;
+
+      case 'i':
+        cmdOpts.incremental = true;
+        break;
+
+      case 'p':
+        cmdOpts.paranoidRate = strtod(optarg, NULL);
+        if (cmdOpts.paranoidRate < 0.0 || cmdOpts.paranoidRate > 1.0) {
+          error("paranoid sampling rate has to be within [0,1]");
+        }
+        break;
+
+      case 'o':
+        cmdOpts.outputDbPath = optarg;
+        break;
+
+      case 'C':
+        cmdOpts.convertPath = optarg;
+        break;
+
+      case 'S':
+        cmdOpts.streaming = true;
+        break;
+
+      case 't':
+        cmdOpts.tmpDir = optarg;
+        break;
+
+      case 'O':
+        cmdOpts.sorted = true;
+        break;
+
+      case 'u':
+        cmdOpts.duplicates = true;
+        break;
+
+      case 'V':
+        cmdOpts.verify = true;
+        break;
+
+      case 'k':
+        cmdOpts.checkpointPath = optarg;
+        break;
+
+      case 'R':
+        cmdOpts.resume = true;
+        break;
+
+      case 'I':
+        cmdOpts.checkpointInterval = strtod(optarg, NULL);
+        if (cmdOpts.checkpointInterval <= 0) {
+          error("incorrect checkpoint interval specified on command line");
         }
         break;
 
+      case 'L':
+        cmdOpts.timeBudget = strtod(optarg, NULL);
+        if (cmdOpts.timeBudget <= 0) {
+          error("incorrect time budget specified on command line");
+        }
+        break;
+
+      case 'K':
+        if (!parse_shard(optarg, cmdOpts.shard)) {
+          error("incorrect shard specified on command line (expected i/N)");
+        }
+        break;
+
+      case 'j':
+        cmdOpts.shard.depth = strtol(optarg, NULL, 10);
+        if (cmdOpts.shard.depth < 1) {
+          error("incorrect shard depth specified on command line");
+        }
+        break;
+
+      case 'M':
+        cmdOpts.merge = true;
+        break;
+
+      case 'P':
+        cmdOpts.progressInterval = strtod(optarg, NULL);
+        if (cmdOpts.progressInterval <= 0) {
+          error("incorrect progress interval specified on command line");
+        }
+        break;
+
+      case 'F':
+        cmdOpts.statusFile = optarg;
+        break;
+
+      case 'x':
+        cmdOpts.traceFile = optarg;
+        break;
+
       case 'h':
       default :
         usage();
     }
   }
 
+  // conversion of reference files does not need a root path
+  if (!cmdOpts.convertPath.empty()) {
+    return cmdOpts;
+  }
   if (argc == optind) {
     usage();
   }
+  // merging takes any number of manifests instead of a root path
+  if (cmdOpts.merge) {
+    if (cmdOpts.streaming || cmdOpts.incremental || cmdOpts.verify
+      || cmdOpts.duplicates || cmdOpts.shard.enabled()
+      || !cmdOpts.checkpointPath.empty()) {
+      error("--merge can only be combined with --compare or --output_db");
+    }
+    if (cmdOpts.compareToRef && !cmdOpts.outputDbPath.empty()) {
+      error("--output_db can not be combined with --compare");
+    }
+    cmdOpts.mergePaths.assign(argv + optind, argv + argc);
+    return cmdOpts;
+  }
+  // unless given explicitly both thread pools use --num_threads threads
+  if (cmdOpts.walkThreads == 0) {
+    cmdOpts.walkThreads = cmdOpts.numThreads;
+  }
+  if (cmdOpts.hashThreads == 0) {
+    cmdOpts.hashThreads = cmdOpts.numThreads;
+  }
+  if (cmdOpts.treeThreads <= 0) {
+    cmdOpts.treeThreads = 1;
+  }
+  if (cmdOpts.incremental && !cmdOpts.compareToRef) {
+    error("incremental mode requires a reference file (--compare)");
+  }
+  if (cmdOpts.streaming && !cmdOpts.compareToRef) {
+    error("streaming mode requires a reference file (--compare)");
+  }
+  if (cmdOpts.streaming && cmdOpts.incremental) {
+    error("incremental mode can not be combined with --streaming");
+  }
+  if (cmdOpts.compareToRef && !cmdOpts.outputDbPath.empty()) {
+    error("--output_db can not be combined with --compare");
+  }
+  if (cmdOpts.duplicates && (cmdOpts.compareToRef || !cmdOpts.outputDbPath.empty())) {
+    error("--duplicates can not be combined with --compare or --output_db");
+  }
+  SampleSpec sampleSpec;
+  bool sampled = parse_sample_digest(cmdOpts.digests[0], sampleSpec);
+  if (cmdOpts.duplicates && sampled) {
+    error("--duplicates requires a full digest");
+  }
+  if (cmdOpts.verify && (!cmdOpts.compareToRef || !sampled)) {
+    error("--verify requires --compare and a sampled digest");
+  }
+  if (cmdOpts.resume && cmdOpts.checkpointPath.empty()) {
+    error("--resume requires a checkpoint journal (--checkpoint)");
+  }
+  if (cmdOpts.duplicates && !cmdOpts.checkpointPath.empty()) {
+    error("--duplicates can not be combined with --checkpoint");
+  }
   cmdOpts.rootPath = argv[optind];
+  cmdOpts.shard.set_root(cmdOpts.rootPath);
 
   return cmdOpts;
 }
+
+
+// default_tmp_dir returns $TMPDIR or /tmp if unset
+std::string default_tmp_dir() {
+  const char* dir = getenv("TMPDIR");
+  if (dir == NULL || *dir == '\0') {
+    return "/tmp";
+  }
+  return dir;
+}
+
+
+// parse_digest_list splits a comma separated list of digest names and
+// checks that all of them are supported
+static std::vector<std::string> parse_digest_list(const std::string& list) {
+  std::vector<std::string> digests;
+  size_t j = 0;
+  while (j <= list.size()) {
+    size_t i = list.find(',', j);
+    if (i == std::string::npos) {
+      i = list.size();
+    }
+    auto name = list.substr(j, i-j);
+    if (!is_digest(name)) {
+      error("unknown hash method " + name + ".");
+    }
+    for (const auto& d : digests) {
+      if (d == name) {
+        error("hash method " + name + " requested more than once.");
+      }
+    }
+    digests.push_back(name);
+    SampleSpec spec;
+    if (digests.size() > 1 && (parse_sample_digest(digests[0], spec)
+      || parse_sample_digest(name, spec))) {
+      error("sampled digests can not be combined with other digests.");
+    }
+    j = i + 1;
+  }
+  return digests;
+}
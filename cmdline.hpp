@@ -6,15 +6,59 @@
 #define CMDLINE_HPP
 
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "device.hpp"
+#include "elevator.hpp"
+#include "hash.hpp"
+#include "reader.hpp"
+#include "shard.hpp"
+
+
+// default_tmp_dir returns $TMPDIR or /tmp if unset
+std::string default_tmp_dir();
 
 
 // POD struct for storing commandline options
 struct CmdLineOpts {
   int numThreads = 1;             // number of threads to use
+  int walkThreads = 0;            // number of directory walker threads
+  int hashThreads = 0;            // number of hashing threads
+  int treeThreads = std::thread::hardware_concurrency(); // threads hashing tree chunks
   bool compareToRef = false;      // do we want to compare against a reference
   bool collectStats = false;      // do we want to collect file/data statistics
-  std::string hashMethod = "md5"; // what hash function to use for digest
+  bool incremental = false;       // only rehash files whose metadata changed
+  double paranoidRate = 0.0;      // fraction of unchanged files rehashed anyway
+  std::vector<std::string> digests{"md5"}; // hash functions to use for digest
+  std::string hashMethod = "md5"; // digest names as written to the output
+  std::string readMode = "async"; // read engine used for pulling in file data
+  size_t bufferSize = defaultBufferSize; // read buffer size in bytes
+  unsigned int queueDepth = defaultQueueDepth; // reads in flight per file (async)
+  size_t batchSize = defaultBatchSize; // small files hashed together (multi-buffer)
+  std::string elevator;           // order files by disk position (inode, extent)
+  size_t elevatorWindow = defaultElevatorWindow; // files ordered at a time
+  bool deviceGroups = false;      // hash threads per device
+  DeviceLimits deviceLimits;      // number of hash threads per device
   std::string referenceFilePath;  // file and if yes, where's the reference file
+  std::string outputDbPath;       // write results as binary reference database
+  std::string convertPath;        // reference file to convert
+  bool streaming = false;         // merge with a path sorted reference
+  bool sorted = false;            // print results in path order
+  bool duplicates = false;        // report duplicate files instead of hashes
+  bool verify = false;            // fully rehash files flagged by a sampled digest
+  std::string checkpointPath;     // journal of finished results
+  bool resume = false;            // continue the scan recorded in the journal
+  double checkpointInterval = defaultCheckpointInterval; // seconds between syncs
+  double timeBudget = 0;          // seconds after which the scan stops (0 = none)
+  double progressInterval = 0;    // seconds between progress reports
+  std::string statusFile;         // progress reports go here instead of stderr
+  std::string traceFile;          // write a Chrome trace of the hot path here
+  std::string tmpDir = default_tmp_dir(); // directory for sort runs
+  Shard shard;                    // part of the tree handled by this process
+  bool merge = false;             // merge shard manifests instead of scanning
+  std::vector<std::string> mergePaths; // shard manifests to merge
   std::string rootPath;           // root of directory to work on
 };
 
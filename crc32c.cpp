@@ -0,0 +1,113 @@
+// this file implements the CRC32C (Castagnoli) checksum with a table driven
+// fallback and an SSE4.2 implementation based on the crc32 instruction
+//
+// (C) Markus Dittrich, 2015
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_X86_CRC32C 1
+#endif
+
+#include "fast_digest.hpp"
+
+
+using Crc32cFunc = uint32_t (*)(uint32_t, const unsigned char*, size_t);
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char* buf, size_t size);
+static Crc32cFunc select_crc32c(const char** name);
+
+static const char* crc32cName = "table";
+static const Crc32cFunc crc32cImpl = select_crc32c(&crc32cName);
+
+
+void Crc32cDigest::update(const char* buf, size_t size) {
+  crc_ = crc32cImpl(crc_, reinterpret_cast<const unsigned char*>(buf), size);
+}
+
+
+std::string Crc32cDigest::final() {
+  uint32_t crc = crc_ ^ 0xffffffff;
+  unsigned char digest[4];
+  for (int i = 0; i < 4; ++i) {
+    digest[i] = static_cast<unsigned char>(crc >> (24 - 8*i));
+  }
+  return to_hex(digest, sizeof(digest));
+}
+
+
+void Crc32cDigest::reset() {
+  crc_ = 0xffffffff;
+}
+
+
+// name of the implementation selected for this CPU
+const char* Crc32cDigest::implementation() {
+  return crc32cName;
+}
+
+
+// crc32c_table is the portable byte-at-a-time implementation
+static uint32_t crc32c_table(uint32_t crc, const unsigned char* buf, size_t size) {
+  static uint32_t table[256];
+  static bool init = [&]() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+      }
+      table[i] = c;
+    }
+    return true;
+  }();
+  (void)init;
+
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+
+#ifdef HAVE_X86_CRC32C
+// crc32c_sse42 uses the SSE4.2 crc32 instruction on 8 bytes at a time
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* buf, size_t size) {
+  while (size > 0 && (reinterpret_cast<uintptr_t>(buf) & 7) != 0) {
+    crc = _mm_crc32_u8(crc, *buf++);
+    --size;
+  }
+#ifdef __x86_64__
+  uint64_t c = crc;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, buf, 8);
+    c = _mm_crc32_u64(c, word);
+    buf += 8;
+    size -= 8;
+  }
+  crc = static_cast<uint32_t>(c);
+#endif
+  while (size > 0) {
+    crc = _mm_crc32_u8(crc, *buf++);
+    --size;
+  }
+  return crc;
+}
+#endif
+
+
+// select_crc32c picks the fastest implementation supported by the CPU
+static Crc32cFunc select_crc32c(const char** name) {
+#ifdef HAVE_X86_CRC32C
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    *name = "sse4.2";
+    return crc32c_sse42;
+  }
+#endif
+  *name = "table";
+  return crc32c_table;
+}
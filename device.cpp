@@ -0,0 +1,131 @@
+// this file implements per device concurrency groups
+//
+// (C) Markus Dittrich 2015
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <cstdlib>
+#include <fstream>
+
+#include "device.hpp"
+
+
+// device_class_name returns the name of class as used in --device_threads
+const char* device_class_name(DeviceClass c) {
+  switch (c) {
+    case DeviceClass::hdd:
+      return "hdd";
+    case DeviceClass::ssd:
+      return "ssd";
+    default:
+      return "other";
+  }
+}
+
+
+// device_class detects the class of dev via the rotational flag in sysfs.
+// Partitions have no queue directory of their own so their parent device
+// is consulted.
+DeviceClass device_class(dev_t dev) {
+  if (major(dev) == 0) {
+    return DeviceClass::other;
+  }
+  std::string base = "/sys/dev/block/" + device_name(dev);
+  for (const auto& p : {base + "/queue/rotational",
+      base + "/../queue/rotational"}) {
+    std::ifstream in(p);
+    int rotational;
+    if (in >> rotational) {
+      return rotational != 0 ? DeviceClass::hdd : DeviceClass::ssd;
+    }
+  }
+  return DeviceClass::other;
+}
+
+
+// device_name returns dev as major:minor
+std::string device_name(dev_t dev) {
+  return std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+}
+
+
+// threads returns the number of hash threads for dev
+int DeviceLimits::threads(dev_t dev, DeviceClass c, int hashThreads) const {
+  int n;
+  auto it = devices.find(dev);
+  if (it != devices.end()) {
+    n = it->second;
+  } else if (c == DeviceClass::hdd) {
+    n = hdd;
+  } else if (c == DeviceClass::ssd) {
+    n = ssd;
+  } else {
+    n = other;
+  }
+  return n > 0 ? n : hashThreads;
+}
+
+
+// parse_device_limits parses a --device_threads spec
+bool parse_device_limits(const std::string& spec, DeviceLimits& limits) {
+  if (spec == "auto") {
+    return true;
+  }
+
+  size_t j = 0;
+  while (j <= spec.size()) {
+    size_t i = spec.find(',', j);
+    if (i == std::string::npos) {
+      i = spec.size();
+    }
+    std::string item = spec.substr(j, i-j);
+    j = i + 1;
+
+    size_t eq = item.find('=');
+    if (eq == std::string::npos) {
+      return false;
+    }
+    std::string key = item.substr(0, eq);
+    char* end;
+    long n = strtol(item.c_str() + eq + 1, &end, 10);
+    if (n <= 0 || *end != '\0' || eq + 1 == item.size()) {
+      return false;
+    }
+
+    if (key == "hdd") {
+      limits.hdd = n;
+    } else if (key == "ssd") {
+      limits.ssd = n;
+    } else if (key == "other") {
+      limits.other = n;
+    } else {
+      unsigned long maj = strtoul(key.c_str(), &end, 10);
+      if (end == key.c_str() || *end != ':') {
+        return false;
+      }
+      const char* minStart = end + 1;
+      unsigned long min = strtoul(minStart, &end, 10);
+      if (end == minStart || *end != '\0') {
+        return false;
+      }
+      limits.devices[makedev(maj, min)] = n;
+    }
+  }
+  return true;
+}
+
+
+// file_device returns the device of file. Files in a directory take the
+// device cached in its DirHandle.
+bool file_device(const FileEntry& file, dev_t& dev) {
+  if (file.dir) {
+    return file.dir->device(dev);
+  }
+  struct stat info;
+  if (file.lstat(&info) < 0) {
+    return false;
+  }
+  dev = info.st_dev;
+  return true;
+}
@@ -0,0 +1,69 @@
+// this file implements per device concurrency groups. If the scanned tree
+// spans several devices (e.g. a HDD, an NVMe drive and a network mount)
+// each device is served by its own group of hash threads whose size
+// depends on the kind of device: rotating disks degrade quickly with
+// concurrent readers while SSDs and network file systems need many reads
+// in flight.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef DEVICE_HPP
+#define DEVICE_HPP
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+
+#include "util.hpp"
+
+
+// capacity of the per device queues. Files beyond it are kept in an
+// overflow list by the dispatcher (see device_worker).
+const size_t deviceQueueSize = 1 << 20;
+
+
+// DeviceClass is the kind of device as detected via sysfs
+enum class DeviceClass {
+  hdd,          // rotating block device
+  ssd,          // non-rotating block device
+  other         // no block device (network or virtual file system)
+};
+
+
+// device_class_name returns the name of class as used in --device_threads
+const char* device_class_name(DeviceClass c);
+
+
+// device_class detects the class of dev via the rotational flag in sysfs
+DeviceClass device_class(dev_t dev);
+
+
+// device_name returns dev as major:minor
+std::string device_name(dev_t dev);
+
+
+// DeviceLimits holds the number of hash threads per device. Counts of 0
+// mean the regular number of hash threads.
+struct DeviceLimits {
+  int hdd = 1;
+  int ssd = 0;
+  int other = 0;
+  std::map<dev_t, int> devices;   // limits of individual devices
+
+  // threads returns the number of hash threads for dev
+  int threads(dev_t dev, DeviceClass c, int hashThreads) const;
+};
+
+
+// parse_device_limits parses a --device_threads spec which is either "auto"
+// or a comma separated list of <hdd|ssd|other|major:minor>=<threads>.
+// Returns false if spec is malformed.
+bool parse_device_limits(const std::string& spec, DeviceLimits& limits);
+
+
+// file_device returns the device of file (or of its directory, which is
+// the same for regular files). Returns false if it can not be determined.
+bool file_device(const FileEntry& file, dev_t& dev);
+
+#endif
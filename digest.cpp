@@ -0,0 +1,114 @@
+// this file implements the digest abstraction used by Hasher
+//
+// (C) Markus Dittrich, 2015
+
+#include <string>
+
+#include "digest.hpp"
+#include "fast_digest.hpp"
+#include "sample_hash.hpp"
+#include "tree_hash.hpp"
+#include "util.hpp"
+
+
+// EvpDigest computes one of openssl's EVP digests
+EvpDigest::EvpDigest(const EVP_MD* md) : md_(md) {
+  ctx_ = EVP_MD_CTX_create();
+  if (ctx_ == NULL) {
+    error("hash(): Failed to create digest context.");
+  }
+  reset();
+}
+
+
+// reset reinitializes the context which keeps its allocated state
+void EvpDigest::reset() {
+  if (!EVP_DigestInit_ex(ctx_, md_, NULL)) {
+    error("hash(): Failed to initalize digest.");
+  }
+}
+
+
+EvpDigest::~EvpDigest() {
+  EVP_MD_CTX_destroy(ctx_);
+}
+
+
+void EvpDigest::update(const char* buf, size_t size) {
+  if(!EVP_DigestUpdate(ctx_, buf, size)) {
+    error("hash(): Failed to update hash");
+  }
+}
+
+
+unsigned int EvpDigest::final_raw(unsigned char* digest) {
+  unsigned int length = 0;
+  if (!EVP_DigestFinal_ex(ctx_, digest, &length)) {
+    error("hash(): Failed to finalize the hash");
+  }
+  return length;
+}
+
+
+std::string EvpDigest::final() {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int length = final_raw(digest);
+  return to_hex(digest, length);
+}
+
+
+// is_digest returns true if name is a supported digest
+bool is_digest(const std::string& name) {
+  TreeSpec spec;
+  SampleSpec sampleSpec;
+  return name == "md5" || name == "sha1" || name == "ripemd160"
+    || name == "crc32c" || name == "xxh64" || name == "blake3"
+    || parse_tree_digest(name, spec) || parse_sample_digest(name, sampleSpec);
+}
+
+
+// make_digest returns a freshly initialized digest for name
+std::unique_ptr<Digest> make_digest(const std::string& name) {
+  TreeSpec spec;
+  if (parse_tree_digest(name, spec)) {
+    return std::make_unique<TreeDigest>(spec);
+  }
+  if (name == "crc32c") {
+    return std::make_unique<Crc32cDigest>();
+  } else if (name == "xxh64") {
+    return std::make_unique<Xxh64Digest>();
+  } else if (name == "blake3") {
+    return std::make_unique<Blake3Digest>();
+  }
+  return std::make_unique<EvpDigest>(evp_digest(name));
+}
+
+
+// evp_digest returns openssl's digest for name and exits if unknown
+const EVP_MD* evp_digest(const std::string& name) {
+  const EVP_MD *md = EVP_get_digestbyname(name.c_str());
+  if (!md) {
+    error("hash function " + name + " not known");
+  }
+  return md;
+}
+
+
+// to_hex converts size bytes at buf to lowercase hex
+std::string to_hex(const unsigned char* buf, size_t size) {
+  std::string hash;
+  append_hex(hash, buf, size);
+  return hash;
+}
+
+
+// append_hex appends size bytes at buf as lowercase hex to out
+void append_hex(std::string& out, const unsigned char* buf, size_t size) {
+  static const char digits[] = "0123456789abcdef";
+  size_t pos = out.size();
+  out.resize(pos + 2*size);
+  for (size_t n = 0; n < size; ++n) {
+    out[pos + 2*n] = digits[buf[n] >> 4];
+    out[pos + 2*n + 1] = digits[buf[n] & 0xf];
+  }
+}
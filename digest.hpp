@@ -0,0 +1,79 @@
+// this file implements the digest abstraction used by Hasher. Each
+// supported digest name maps to a Digest object which is fed the file
+// content chunk by chunk.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef DIGEST_HPP
+#define DIGEST_HPP
+
+#include <memory>
+#include <string>
+
+#include <openssl/evp.h>
+
+
+// Digest is the common interface of all digest implementations
+class Digest {
+
+public:
+
+  virtual ~Digest() {};
+
+  // update feeds size bytes at buf into the digest
+  virtual void update(const char* buf, size_t size) = 0;
+
+  // final returns the hex encoded digest
+  virtual std::string final() = 0;
+
+  // reset reinitializes the digest so it can be reused for the next file
+  virtual void reset() = 0;
+};
+
+
+// EvpDigest computes one of openssl's EVP digests
+class EvpDigest : public Digest {
+
+public:
+
+  EvpDigest(const EVP_MD* md);
+  ~EvpDigest();
+
+  EvpDigest(const EvpDigest& d) = delete;
+  EvpDigest& operator=(const EvpDigest& d) = delete;
+
+  void update(const char* buf, size_t size) override;
+  std::string final() override;
+  void reset() override;
+
+  // final_raw finalizes the digest into digest (of at least EVP_MAX_MD_SIZE
+  // bytes) and returns its length
+  unsigned int final_raw(unsigned char* digest);
+
+private:
+
+  const EVP_MD* md_;
+  EVP_MD_CTX* ctx_;
+};
+
+
+// is_digest returns true if name is a supported digest
+bool is_digest(const std::string& name);
+
+
+// make_digest returns a freshly initialized digest for name
+std::unique_ptr<Digest> make_digest(const std::string& name);
+
+
+// evp_digest returns openssl's digest for name and exits if unknown
+const EVP_MD* evp_digest(const std::string& name);
+
+
+// to_hex converts size bytes at buf to lowercase hex
+std::string to_hex(const unsigned char* buf, size_t size);
+
+
+// append_hex appends size bytes at buf as lowercase hex to out
+void append_hex(std::string& out, const unsigned char* buf, size_t size);
+
+#endif
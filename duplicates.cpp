@@ -0,0 +1,331 @@
+// this file implements phantom's duplicate finder mode
+//
+// (C) Markus Dittrich 2015
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "duplicates.hpp"
+#include "digest.hpp"
+#include "hash.hpp"
+#include "output.hpp"
+#include "reader.hpp"
+#include "refParser.hpp"
+#include "trace.hpp"
+
+
+// DupFile is a regular file found during the walk
+struct DupFile {
+  FileEntry file;
+  FileMeta meta;
+};
+
+
+// Candidate is an inode which may have duplicates. Its paths are the
+// range [begin, end) of the (sorted) file list.
+struct Candidate {
+  long long size;
+  size_t begin;
+  size_t end;
+  std::string partial;
+  std::string hash;
+};
+
+
+// parallel_for calls f(thread id, i) for all i in [0, n) using up to
+// numThreads threads
+template <typename F>
+static void parallel_for(size_t n, int numThreads, F f) {
+  std::atomic<size_t> next{0};
+  auto run = [&](int id) {
+    size_t i;
+    while ((i = next.fetch_add(1)) < n) {
+      f(id, i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int id = 1; id < numThreads; ++id) {
+    threads.push_back(std::thread(run, id));
+  }
+  run(0);
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+
+// keep_groups keeps the candidates whose key (as given by key) is shared
+// with at least one other candidate. Candidates have to be sorted by key.
+template <typename K>
+static void keep_groups(std::vector<Candidate>& cands, K key) {
+  std::vector<Candidate> kept;
+  size_t i = 0;
+  while (i < cands.size()) {
+    size_t j = i + 1;
+    while (j < cands.size() && key(cands[j]) == key(cands[i])) {
+      ++j;
+    }
+    if (j - i > 1) {
+      for (size_t k = i; k < j; ++k) {
+        kept.push_back(std::move(cands[k]));
+      }
+    }
+    i = j;
+  }
+  cands.swap(kept);
+}
+
+
+// collect_files lstats the files of the file queue in parallel and returns
+// the regular ones
+static std::vector<DupFile> collect_files(FileQueue& fileQueue,
+  const Printer& printer, int numThreads) {
+
+  std::vector<std::vector<DupFile>> found(numThreads);
+  std::vector<std::thread> threads;
+  for (int id = 0; id < numThreads; ++id) {
+    threads.push_back(std::thread([&, id]() {
+      trace_thread_name("duplicate worker");
+      FileEntry file;
+      while (fileQueue.pop(file)) {
+        struct stat info;
+        int rc;
+        {
+          TraceScope ts(TraceStage::lstat);
+          rc = file.lstat(&info);
+        }
+        if (rc < 0) {
+          printer.cerr("lstat failed on " + file.path());
+          continue;
+        }
+        if (S_ISREG(info.st_mode)) {
+          found[id].push_back({std::move(file), meta_from_stat(info)});
+        }
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::vector<DupFile> files;
+  for (auto& f : found) {
+    std::move(f.begin(), f.end(), std::back_inserter(files));
+  }
+  return files;
+}
+
+
+// partial_hash hashes the first and last partialHashSize bytes of file
+// which is expected to be larger than 2*partialHashSize bytes. Returns an
+// empty string if the file could not be read.
+static std::string partial_hash(const FileEntry& file, long long size,
+  Digest& digest, std::vector<char>& buf, const Printer& printer) {
+
+  try {
+    Fd fd(file, O_RDONLY | O_NOATIME);
+    digest.reset();
+    for (off_t off : {off_t(0), off_t(size - partialHashSize)}) {
+      size_t total = 0;
+      while (total < partialHashSize) {
+        ssize_t n;
+        {
+          TraceScope ts(TraceStage::read);
+          n = pread(fd.get(), buf.data() + total, partialHashSize - total,
+            off + total);
+        }
+        if (n < 0 && errno == EINTR) {
+          continue;
+        } else if (n <= 0) {
+          throw FailedFileAccess(file.path());
+        }
+        total += n;
+      }
+      TraceScope ts(TraceStage::digest);
+      digest.update(buf.data(), total);
+    }
+    return digest.final();
+  } catch (FailedFileAccess& e) {
+    printer.cerr(e.what());
+    return std::string();
+  }
+}
+
+
+// duplicate_worker collects the files of the file queue and reports the
+// groups of duplicate files found among them on stdout. Once the time
+// budget is used up no more files are read so the report only covers the
+// candidates hashed until then.
+void duplicate_worker(FileQueue& fileQueue, const Printer& printer,
+  Stats& stats, const CmdLineOpts& opts) {
+
+  int numThreads = opts.hashThreads;
+  auto files = collect_files(fileQueue, printer, numThreads);
+  long long totalBytes = 0;
+  for (const auto& f : files) {
+    totalBytes += f.meta.size;
+  }
+
+  // stage 1: group by size; paths of the same inode form a single candidate.
+  // Empty files are skipped since there is nothing to reclaim.
+  std::sort(files.begin(), files.end(), [](const DupFile& a, const DupFile& b) {
+    if (a.meta.size != b.meta.size) {
+      return a.meta.size < b.meta.size;
+    }
+    if (a.meta.dev != b.meta.dev) {
+      return a.meta.dev < b.meta.dev;
+    }
+    return a.meta.ino < b.meta.ino;
+  });
+  std::vector<Candidate> cands;
+  for (size_t i = 0; i < files.size();) {
+    size_t j = i + 1;
+    while (j < files.size() && files[j].meta.dev == files[i].meta.dev
+      && files[j].meta.ino == files[i].meta.ino) {
+      ++j;
+    }
+    if (files[i].meta.size > 0) {
+      cands.push_back({files[i].meta.size, i, j, std::string(), std::string()});
+    }
+    i = j;
+  }
+  keep_groups(cands, [](const Candidate& c) { return c.size; });
+  size_t sizeCands = cands.size();
+
+  // stage 2: partial hashes of files which are not covered by them entirely
+  parallel_for(cands.size(), numThreads, [&](int, size_t i) {
+    thread_local std::unique_ptr<Digest> digest;
+    thread_local std::vector<char> buf;
+    Candidate& c = cands[i];
+    if (static_cast<size_t>(c.size) <= 2*partialHashSize || stop_requested()) {
+      return;
+    }
+    if (!digest) {
+      digest = make_digest(partialHashDigest);
+      buf.resize(partialHashSize);
+    }
+    auto start = std::chrono::steady_clock::now();
+    c.partial = partial_hash(files[c.begin].file, c.size, *digest, buf, printer);
+    stats.add_read(partialHashMode, 2*partialHashSize,
+      std::chrono::steady_clock::now() - start);
+  });
+  cands.erase(std::remove_if(cands.begin(), cands.end(), [](const Candidate& c) {
+      return static_cast<size_t>(c.size) > 2*partialHashSize && c.partial.empty();
+    }), cands.end());
+  std::stable_sort(cands.begin(), cands.end(),
+    [](const Candidate& a, const Candidate& b) {
+      return a.size != b.size ? a.size < b.size : a.partial < b.partial;
+    });
+  keep_groups(cands, [](const Candidate& c) {
+    return std::make_pair(c.size, c.partial);
+  });
+  size_t partialCands = cands.size();
+
+  // stage 3: full hashes with the requested digests
+  std::vector<std::unique_ptr<ReadEngine>> engines;
+  std::vector<std::unique_ptr<Hasher>> hashers;
+  for (int id = 0; id < numThreads; ++id) {
+    engines.push_back(make_read_engine(opts.readMode, opts.bufferSize,
+      opts.queueDepth));
+    hashers.push_back(std::unique_ptr<Hasher>(new Hasher(opts.digests,
+      *engines.back(), opts.treeThreads)));
+  }
+  parallel_for(cands.size(), numThreads, [&](int id, size_t i) {
+    if (stop_requested()) {
+      return;
+    }
+    Candidate& c = cands[i];
+    auto start = std::chrono::steady_clock::now();
+    c.hash = hashers[id]->hash(files[c.begin].file, c.size);
+    stats.add(c.size);
+    stats.add_read(Hasher::is_small(c.size) ? smallFileMode
+      : engines[id]->name(), c.size, std::chrono::steady_clock::now() - start);
+  });
+  cands.erase(std::remove_if(cands.begin(), cands.end(),
+    [](const Candidate& c) { return c.hash.empty(); }), cands.end());
+  std::sort(cands.begin(), cands.end(),
+    [](const Candidate& a, const Candidate& b) {
+      return a.size != b.size ? a.size < b.size : a.hash < b.hash;
+    });
+  keep_groups(cands, [](const Candidate& c) {
+    return std::make_pair(c.size, c.hash);
+  });
+
+  // report groups with the most wasted space first
+  // Hard links do not take up extra space so only additional inodes count
+  // as reclaimable.
+  struct Group {
+    long long size;
+    std::string hash;
+    long long inodes;
+    std::vector<std::string> paths;
+    long long wasted() const {
+      return size * (inodes - 1);
+    }
+  };
+  std::vector<Group> groups;
+  for (size_t i = 0; i < cands.size(); ++i) {
+    if (i == 0 || cands[i].size != cands[i-1].size
+      || cands[i].hash != cands[i-1].hash) {
+      groups.push_back({cands[i].size, cands[i].hash, 0, {}});
+    }
+    ++groups.back().inodes;
+    for (size_t k = cands[i].begin; k < cands[i].end; ++k) {
+      groups.back().paths.push_back(files[k].file.path());
+    }
+  }
+  std::sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+    return a.wasted() != b.wasted() ? a.wasted() > b.wasted() : a.hash < b.hash;
+  });
+
+  // the report goes through an output buffer like all other results so it
+  // does not interleave with messages on stderr
+  OutputBuffer out(false, opts.tmpDir);
+  std::string line;
+  long long numDuplicates = 0;
+  long long wasted = 0;
+  for (auto& g : groups) {
+    std::sort(g.paths.begin(), g.paths.end());
+    line.assign("duplicates      :  ");
+    append_int(line, static_cast<long long>(g.paths.size()));
+    line.append(" files of ");
+    append_int(line, g.size);
+    line.append(" bytes (").append(opts.hashMethod).append(" ").append(g.hash)
+      .append(")");
+    out.add_line(g.paths.front(), line);
+    for (const auto& p : g.paths) {
+      out.add_line(p, "                   " + p);
+    }
+    numDuplicates += g.paths.size();
+    wasted += g.wasted();
+  }
+
+  if (opts.collectStats) {
+    line.assign("\nduplicate search: ");
+    append_int(line, static_cast<long long>(files.size()));
+    line.append(" files (");
+    append_int(line, totalBytes);
+    line.append(" bytes), ");
+    append_int(line, static_cast<long long>(sizeCands));
+    line.append(" inodes of equal size, ");
+    append_int(line, static_cast<long long>(partialCands));
+    line.append(" after partial hash, ");
+    append_int(line, numDuplicates);
+    line.append(" duplicates in ");
+    append_int(line, static_cast<long long>(groups.size()));
+    line.append(" groups (");
+    append_int(line, wasted);
+    line.append(" bytes reclaimable)");
+    out.add_line(std::string(), line);
+  }
+  out.finish();
+}
@@ -0,0 +1,38 @@
+// this file implements phantom's duplicate finder mode. Instead of hashing
+// every file, candidates are narrowed down in stages:
+//
+//   1) files are grouped by size and files with a unique size are dropped
+//      (hard links of the same inode count as a single file)
+//   2) files larger than 2*partialHashSize get a cheap hash of their first
+//      and last partialHashSize bytes; files with a unique partial hash
+//      are dropped
+//   3) the remaining files are fully hashed with the requested digests
+//
+// Files sharing size and full hash are reported as duplicates.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef DUPLICATES_HPP
+#define DUPLICATES_HPP
+
+#include "cmdline.hpp"
+#include "stats.hpp"
+#include "util.hpp"
+
+
+// bytes at the head and tail of a file covered by the partial hash
+const size_t partialHashSize = 16*1024;
+
+// digest used for partial hashes. Collisions only cost a full hash.
+const std::string partialHashDigest = "xxh64";
+
+// read mode under which partial hash reads are accounted
+const std::string partialHashMode = "partial";
+
+
+// duplicate_worker collects the files of the file queue and reports the
+// groups of duplicate files found among them on stdout
+void duplicate_worker(FileQueue& fileQueue, const Printer& printer,
+  Stats& stats, const CmdLineOpts& opts);
+
+#endif
@@ -0,0 +1,82 @@
+// this file implements disk order scheduling of files for rotating media
+//
+// (C) Markus Dittrich 2015
+
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+#include "elevator.hpp"
+
+
+// is_elevator_mode returns true if mode names a known elevator mode
+bool is_elevator_mode(const std::string& mode) {
+  return mode == "inode" || mode == "extent";
+}
+
+
+// first_extent looks up the physical offset of the first extent of the open
+// file fd. FIEMAP is tried first; FIBMAP needs CAP_SYS_RAWIO but works on
+// file systems without FIEMAP support. Files without extents (empty or
+// inline) are at offset 0.
+static bool first_extent(int fd, unsigned long long& offset) {
+  alignas(struct fiemap) char buf[sizeof(struct fiemap)
+    + sizeof(struct fiemap_extent)] = {};
+  auto* map = reinterpret_cast<struct fiemap*>(buf);
+  map->fm_start = 0;
+  map->fm_length = FIEMAP_MAX_OFFSET;
+  map->fm_extent_count = 1;
+  if (ioctl(fd, FS_IOC_FIEMAP, map) == 0) {
+    offset = map->fm_mapped_extents > 0 ? map->fm_extents[0].fe_physical : 0;
+    return true;
+  }
+
+  int block = 0;
+  int blockSize = 0;
+  if (ioctl(fd, FIBMAP, &block) == 0 && ioctl(fd, FIGETBSZ, &blockSize) == 0) {
+    offset = static_cast<unsigned long long>(static_cast<unsigned int>(block))
+      * static_cast<unsigned int>(blockSize);
+    return true;
+  }
+  return false;
+}
+
+
+// disk_position returns the position used to order file and settles the
+// mode on the first file which can be opened
+unsigned long long disk_position(const FileEntry& file, PositionMode& mode) {
+  if (mode == PositionMode::inode) {
+    return file.ino;
+  }
+  try {
+    Fd fd(file, O_RDONLY | O_NOATIME);
+    unsigned long long offset;
+    bool mapped = first_extent(fd.get(), offset);
+    if (mode == PositionMode::probe) {
+      mode = mapped ? PositionMode::extent : PositionMode::inode;
+    }
+    if (mapped) {
+      return offset;
+    }
+    if (mode == PositionMode::inode) {
+      return file.ino;
+    }
+  } catch (FailedFileAccess& e) {
+    // the hash stage reports files which can not be opened
+  }
+  return 0;
+}
+
+
+// next removes and returns the next file of the sweep
+FileEntry Elevator::next() {
+  auto it = pending_.lower_bound(head_);
+  if (it == pending_.end()) {
+    it = pending_.begin();
+  }
+  head_ = it->first;
+  FileEntry file = std::move(it->second);
+  pending_.erase(it);
+  return file;
+}
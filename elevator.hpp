@@ -0,0 +1,76 @@
+// this file implements disk order scheduling of files for rotating media.
+// Files are collected in a sliding window and handed out in ascending order
+// of their position on disk (C-SCAN elevator): the sweep picks the next file
+// at or past the previous one and starts over at the lowest position once
+// it reaches the end of the window. The position is either the physical
+// offset of the file's first extent (via FIEMAP or FIBMAP) or its inode
+// number, which on most local file systems roughly follows disk layout.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef ELEVATOR_HPP
+#define ELEVATOR_HPP
+
+#include <map>
+#include <string>
+
+#include "util.hpp"
+
+
+// default number of files the elevator keeps for ordering
+const size_t defaultElevatorWindow = 16384;
+
+
+// is_elevator_mode returns true if mode names a known elevator mode
+// ("inode" or "extent")
+bool is_elevator_mode(const std::string& mode);
+
+
+// PositionMode is the kind of position files are ordered by. Extent mode
+// starts out as probe: the first file which can be opened decides whether
+// the file system maps extents (extent) or not (inode), so all positions
+// an elevator orders are of the same kind.
+enum class PositionMode { probe, extent, inode };
+
+
+// disk_position returns the position used to order file. For extents it is
+// the physical byte offset of the first extent, otherwise the inode number.
+// Files which can not be opened or mapped in extent mode are at 0.
+unsigned long long disk_position(const FileEntry& file, PositionMode& mode);
+
+
+// Elevator orders files by disk position within a window of files
+class Elevator {
+
+public:
+
+  explicit Elevator(size_t window) : window_(window) {};
+
+  Elevator(const Elevator& e) = delete;
+  Elevator& operator=(const Elevator& e) = delete;
+
+  bool empty() const {
+    return pending_.empty();
+  }
+
+  // full returns true if a file has to be taken out before adding more
+  bool full() const {
+    return pending_.size() >= window_;
+  }
+
+  void add(unsigned long long pos, FileEntry&& file) {
+    pending_.emplace(pos, std::move(file));
+  }
+
+  // next removes and returns the next file of the sweep. Must not be
+  // called on an empty elevator.
+  FileEntry next();
+
+private:
+
+  size_t window_;
+  unsigned long long head_ = 0;
+  std::multimap<unsigned long long, FileEntry> pending_;
+};
+
+#endif
@@ -0,0 +1,109 @@
+// this file implements phantom's native (non openssl) digests aimed at fast
+// bit-rot detection on trusted storage:
+//
+//   crc32c  - Castagnoli CRC32 (SSE4.2 crc32 instruction if available)
+//   xxh64   - 64 bit xxHash
+//   blake3  - BLAKE3 (multi-chunk AVX-512 / AVX2 / SSE2 kernels if available)
+//
+// The fastest implementation supported by the CPU is selected at runtime;
+// all implementations of a digest produce identical results.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef FAST_DIGEST_HPP
+#define FAST_DIGEST_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "digest.hpp"
+
+
+// Crc32cDigest computes the CRC32C checksum
+class Crc32cDigest : public Digest {
+
+public:
+
+  void update(const char* buf, size_t size) override;
+  std::string final() override;
+  void reset() override;
+
+  // name of the implementation selected for this CPU
+  static const char* implementation();
+
+private:
+
+  uint32_t crc_ = 0xffffffff;
+};
+
+
+// Xxh64Digest computes the 64 bit xxHash with seed 0
+class Xxh64Digest : public Digest {
+
+public:
+
+  void update(const char* buf, size_t size) override;
+  std::string final() override;
+  void reset() override;
+
+private:
+
+  uint64_t v_[4] = {
+    0x9E3779B185EBCA87ULL + 0xC2B2AE3D27D4EB4FULL,
+    0xC2B2AE3D27D4EB4FULL,
+    0,
+    0 - 0x9E3779B185EBCA87ULL
+  };
+  unsigned char buf_[32];
+  size_t bufFill_ = 0;
+  uint64_t totalLen_ = 0;
+};
+
+
+// Blake3Digest computes the 256 bit BLAKE3 hash
+class Blake3Digest : public Digest {
+
+public:
+
+  Blake3Digest();
+
+  void update(const char* buf, size_t size) override;
+  std::string final() override;
+  void reset() override;
+
+  // name of the implementation selected for this CPU
+  static const char* implementation();
+
+private:
+
+  struct Output {
+    uint32_t cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t blockLen;
+    uint32_t flags;
+  };
+
+  void chunk_update(const unsigned char* input, size_t size);
+  Output chunk_output() const;
+  void reset_chunk(uint64_t counter);
+  void push_cv(const uint32_t cv[8], uint64_t totalChunks);
+
+  // current chunk
+  uint32_t chunkCv_[8];
+  uint64_t chunkCounter_ = 0;
+  unsigned char block_[64];
+  size_t blockLen_ = 0;
+  size_t blocksCompressed_ = 0;
+
+  // stack of chaining values of completed subtrees
+  std::vector<uint32_t> cvStack_;
+};
+
+
+// fast_digest_implementations returns a human readable summary of the
+// implementations selected for this CPU
+std::string fast_digest_implementations();
+
+#endif
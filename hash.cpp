@@ -2,56 +2,264 @@
 //
 // (C) Markus Dittrich, 2015
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
 #include <string>
 
 #include "hash.hpp"
+#include "multi_buffer.hpp"
+#include "trace.hpp"
+#include "tree_hash.hpp"
 #include "util.hpp"
 
 
-// return the requested (by name) hash of the file at the provided path
-std::string hasher(const std::string& digest_name, const std::string& path) {
+Hasher::Hasher(const std::vector<std::string>& digestNames,
+  ReadEngine& engine, int treeThreads, size_t batchSize) :
+  digestNames_(digestNames), engine_(engine), smallBuf_(smallFileSize + 1),
+  treeThreads_(treeThreads) {
 
-  const EVP_MD *md = EVP_get_digestbyname(digest_name.c_str());
-  if (!md) {
-    error("hash function " + digest_name + " not known");
+  sampled_ = digestNames.size() == 1
+    && parse_sample_digest(digestNames[0], sampleSpec_);
+  for (const auto& name : digestNames) {
+    digests_.push_back(make_digest(sampled_ ? sampleSpec_.md : name));
   }
+  tree_ = treeThreads > 1 && digestNames.size() == 1
+    && parse_tree_digest(digestNames[0], treeSpec_);
+
+  bool multiBuffer = !digestNames.empty();
+  for (const auto& name : digestNames) {
+    multiBuffer = multiBuffer && has_multi_buffer(name);
+  }
+  if (multiBuffer && batchSize > 1) {
+    batchSize_ = batchSize;
+    batch_.resize(batchSize);
+  }
+  consume_ = [this](const char* buf, size_t size) {
+    TraceScope ts(TraceStage::digest);
+    for (auto& d : digests_) {
+      d->update(buf, size);
+    }
+  };
+}
+
+
+// hash returns the joined hashes of file which is expected to be size bytes
+// long or an empty string if the file could not be read
+std::string Hasher::hash(const FileEntry& file, off_t size) {
 
   try {
-    File file(path);
+    if (sampled_) {
+      return sample_hash(sampleSpec_, *digests_[0], file, size, sampleBuf_);
+    }
+    if (tree_ && static_cast<size_t>(size) > 2*treeSpec_.chunkSize) {
+      return tree_hash(treeSpec_, file.path(), treeThreads_, defaultBufferSize);
+    }
+
+    for (auto& d : digests_) {
+      d->reset();
+    }
+    if (is_small(size)) {
+      read_small(file, size);
+    } else {
+      engine_.read_file(file, consume_);
+    }
+
+    std::string hash;
+    for (size_t i = 0; i < digests_.size(); ++i) {
+      if (i > 0) {
+        hash.push_back(digestSeparator);
+      }
+      hash.append(digests_[i]->final());
+    }
+    return hash;
+
+  } catch (FailedFileAccess& e) {
+    std::cerr << e.what() << "\n";
+    return std::string();
+  }
+}
 
-    EVP_MD_CTX c;
-    EVP_MD_CTX_init(&c);
 
-    if (!EVP_DigestInit_ex(&c, md, NULL)) {
-      error("hash(): Failed to initalize digest.");
+// read_small reads a small file in as few read() calls as possible. Since
+// the buffer is larger than any small file this is a single one unless the
+// file grew since it was stat'ed. Reading the file does not update its
+// access time.
+void Hasher::read_small(const FileEntry& file, off_t size) {
+  Fd fd(file, O_RDONLY | O_NOATIME);
+  char* buf = smallBuf_.get();
+  off_t total = 0;
+  while (true) {
+    ssize_t n;
+    {
+      TraceScope ts(TraceStage::read);
+      n = read(fd.get(), buf, smallBuf_.size());
     }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      throw FailedFileAccess(file.path());
+    } else if (n == 0) {
+      break;
+    }
+    consume_(buf, n);
+    total += n;
+
+    // a short read once the expected size has been read means we hit EOF
+    if (total >= size && static_cast<size_t>(n) < smallBuf_.size()) {
+      break;
+    }
+  }
+}
+
+
+// add_to_batch reads the small file into the next batch slot. The buffer
+// is one byte larger than the file so growth past size can be detected.
+void Hasher::add_to_batch(const FileEntry& file, off_t size) {
+  BatchSlot& slot = batch_[batchFill_++];
+  slot.size = 0;
+  slot.direct = false;
+  slot.hash.clear();
+  if (slot.buf.size() < static_cast<size_t>(size) + 1) {
+    slot.buf.resize(size + 1);
+  }
+
+  try {
+    Fd fd(file, O_RDONLY | O_NOATIME);
+    char* buf = reinterpret_cast<char*>(slot.buf.data());
+    size_t total = 0;
+    while (total < slot.buf.size()) {
+      ssize_t n;
+      {
+        TraceScope ts(TraceStage::read);
+        n = read(fd.get(), buf + total, slot.buf.size() - total);
+      }
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0) {
+        throw FailedFileAccess(file.path());
+      } else if (n == 0) {
+        break;
+      }
+      total += n;
 
-    char buffer[512];
-    size_t nread;
-    while ((nread = fread(buffer, 1, sizeof(buffer), file.get())) > 0) {
-      if(!EVP_DigestUpdate(&c, buffer, nread)) {
-        error("hash(): Failed to update hash");
+      // a short read once the expected size has been read means we hit EOF
+      if (total >= static_cast<size_t>(size)) {
+        break;
       }
     }
+    slot.size = total;
+  } catch (FailedFileAccess& e) {
+    std::cerr << e.what() << "\n";
+    slot.direct = true;
+    return;
+  }
+
+  if (slot.size > static_cast<size_t>(size)) {
+    slot.direct = true;
+    slot.hash = hash(file, slot.size);
+  }
+}
 
-    unsigned int length = 0;
-    unsigned char digest[EVP_MAX_MD_SIZE];
-    if (!EVP_DigestFinal_ex(&c, digest, &length)) {
-      error("hash(): Failed to finalize the hash");
+
+// finish_batch hashes all batched files with the multi-buffer kernels and
+// returns their joined hashes in the order the files were added
+std::vector<std::string> Hasher::finish_batch() {
+  std::vector<Message> messages;
+  for (size_t i = 0; i < batchFill_; ++i) {
+    if (!batch_[i].direct) {
+      messages.push_back({batch_[i].buf.data(), batch_[i].size});
     }
+  }
 
-    if (!EVP_MD_CTX_cleanup(&c)) {
-      error("hash(): Failed to cleanup hash structure");
+  std::vector<std::vector<std::string>> digests(digestNames_.size());
+  {
+    TraceScope ts(TraceStage::digest);
+    for (size_t d = 0; d < digestNames_.size(); ++d) {
+      multi_buffer_hash(digestNames_[d], messages, digests[d]);
     }
+  }
 
-    std::string hash(2*length, '0');
-    for (unsigned int n = 0; n < length; ++n) {
-      snprintf(&(hash[n*2]), length*2, "%02x", (unsigned int)digest[n]);
+  std::vector<std::string> hashes(batchFill_);
+  size_t m = 0;
+  for (size_t i = 0; i < batchFill_; ++i) {
+    if (batch_[i].direct) {
+      hashes[i] = std::move(batch_[i].hash);
+      continue;
     }
-    return hash;
+    for (size_t d = 0; d < digests.size(); ++d) {
+      if (d > 0) {
+        hashes[i].push_back(digestSeparator);
+      }
+      hashes[i].append(digests[d][m]);
+    }
+    ++m;
+  }
+  batchFill_ = 0;
+  return hashes;
+}
 
-  } catch (FailedFileAccess e) {
-    std::cerr << e.what() << "\n";
-    return std::string();
+
+// compare_digests compares the (joined) hash computed with digests against
+// the reference hash computed with refMethod
+DigestMatch compare_digests(const std::vector<std::string>& digests,
+  const std::string& hash, const std::string& refMethod,
+  const std::string& refHash) {
+
+  if (refMethod == join_digests(digests)) {
+    return hash == refHash ? DigestMatch::same : DigestMatch::differs;
+  }
+
+  auto found = split_digests(hash);
+  auto refMethods = split_digests(refMethod);
+  auto refHashes = split_digests(refHash);
+  if (refHashes.size() != refMethods.size()) {
+    return DigestMatch::differs;
+  }
+  bool common = false;
+  bool differs = false;
+  for (size_t i = 0; i < digests.size(); ++i) {
+    for (size_t j = 0; j < refMethods.size(); ++j) {
+      if (digests[i] != refMethods[j]) {
+        continue;
+      }
+      common = true;
+      if (i >= found.size() || found[i] != refHashes[j]) {
+        differs = true;
+      }
+    }
+  }
+  if (!common) {
+    return DigestMatch::noCommon;
+  }
+  return differs ? DigestMatch::differs : DigestMatch::same;
+}
+
+
+// join_digests joins a list of digest names or values via digestSeparator
+std::string join_digests(const std::vector<std::string>& digests) {
+  std::string out;
+  for (const auto& d : digests) {
+    if (!out.empty()) {
+      out += digestSeparator;
+    }
+    out += d;
+  }
+  return out;
+}
+
+
+// split_digests splits a list of digest names or values at digestSeparator
+std::vector<std::string> split_digests(const std::string& digests) {
+  std::vector<std::string> out;
+  size_t j = 0;
+  size_t i;
+  while ((i = digests.find(digestSeparator, j)) != std::string::npos) {
+    out.push_back(digests.substr(j, i-j));
+    j = i + 1;
   }
+  out.push_back(digests.substr(j));
+  return out;
 }
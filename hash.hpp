@@ -5,11 +5,153 @@
 #ifndef HASH_HPP
 #define HASH_HPP
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include <openssl/evp.h>
 
-// return the requested (by name) hash of the file at the provided path
-std::string hasher(const std::string& digest_name, const std::string& path);
+#include "digest.hpp"
+#include "reader.hpp"
+#include "sample_hash.hpp"
+#include "tree_hash.hpp"
+
+
+// separator between digest names and digest values if a file is hashed
+// with more than one digest
+const char digestSeparator = ':';
+
+
+// files of up to smallFileSize bytes are read with a single read() into a
+// per thread buffer instead of going through the read engine
+const size_t smallFileSize = 64*1024;
+
+// read mode under which small file reads are accounted
+const std::string smallFileMode = "small";
+
+// read mode under which batched small file reads are accounted
+const std::string batchFileMode = "batch";
+
+// read mode under which the reads of sampled digests are accounted
+const std::string sampleFileMode = "sample";
+
+// default number of small files hashed together by multi-buffer kernels
+const size_t defaultBatchSize = 32;
+
+
+// Hasher computes the requested (by name) hashes of files. Each hash thread
+// owns its own Hasher so digests are only resolved once and their contexts
+// are reset and reused for every file. The file content is pulled in once
+// via the provided read engine (or the small file path) and fed to all
+// digests. The hashes are joined by digestSeparator.
+// If a single tree digest is requested, large files are instead hashed
+// chunk-parallel by up to treeThreads threads (see tree_hash).
+// A sampled digest (which has to be the only one) only reads the sampled
+// blocks of a file (see sample_hash.hpp).
+// If all digests have multi-buffer kernels, small files can instead be
+// collected into batches of up to batchSize files via add_to_batch and then
+// hashed together by finish_batch.
+class Hasher {
+
+public:
+
+  Hasher(const std::vector<std::string>& digestNames, ReadEngine& engine,
+    int treeThreads = 1, size_t batchSize = 1);
+
+  Hasher(const Hasher& h) = delete;
+  Hasher& operator=(const Hasher& h) = delete;
+
+  // hash returns the joined hashes of file which is expected to be size
+  // bytes long or an empty string if the file could not be read
+  std::string hash(const FileEntry& file, off_t size);
+
+  // is_small returns true if files of size bytes take the small file path
+  static bool is_small(off_t size) {
+    return static_cast<size_t>(size) <= smallFileSize;
+  }
+
+  // sampled returns true if files are hashed with a sampled digest
+  bool sampled() const {
+    return sampled_;
+  }
+
+  // sampled_bytes returns the number of bytes a sampled digest reads of a
+  // file of size bytes
+  size_t sampled_bytes(off_t size) const {
+    return std::min<size_t>(size,
+      static_cast<size_t>(sampleSpec_.samples) * sampleBlockSize);
+  }
+
+  // batching returns true if small files are hashed in batches
+  bool batching() const {
+    return batchSize_ > 1;
+  }
+
+  // add_to_batch reads the small file into the next batch slot
+  void add_to_batch(const FileEntry& file, off_t size);
+
+  // batch_full returns true if the batch has to be finished before more
+  // files can be added
+  bool batch_full() const {
+    return batchFill_ >= batchSize_;
+  }
+
+  // finish_batch hashes all batched files and returns their joined hashes
+  // in the order the files were added. The batch is empty afterwards.
+  std::vector<std::string> finish_batch();
+
+private:
+
+  // BatchSlot holds the content of a batched file. If the file could not
+  // be read or grew past its stat'ed size it is hashed on its own and the
+  // result is kept in hash.
+  struct BatchSlot {
+    std::vector<unsigned char> buf;
+    size_t size = 0;
+    bool direct = false;
+    std::string hash;
+  };
+
+  void read_small(const FileEntry& file, off_t size);
+
+  std::vector<std::string> digestNames_;
+  std::vector<std::unique_ptr<Digest>> digests_;
+  ReadEngine& engine_;
+  ReadConsumer consume_;
+  AlignedBuffer smallBuf_;
+  int treeThreads_;
+  bool tree_ = false;
+  TreeSpec treeSpec_;
+  bool sampled_ = false;
+  SampleSpec sampleSpec_;
+  std::vector<char> sampleBuf_;
+  size_t batchSize_ = 1;
+  size_t batchFill_ = 0;
+  std::vector<BatchSlot> batch_;
+};
+
+
+// DigestMatch is the outcome of comparing a file's digests to the reference
+enum class DigestMatch {
+  same,
+  differs,
+  noCommon      // file and reference share no digest
+};
+
+
+// compare_digests compares the (joined) hash computed with digests against
+// the reference hash computed with refMethod. If the two were computed with
+// different sets of digests only the digests present in both are compared.
+DigestMatch compare_digests(const std::vector<std::string>& digests,
+  const std::string& hash, const std::string& refMethod,
+  const std::string& refHash);
+
+
+// join_digests joins a list of digest names or values via digestSeparator
+std::string join_digests(const std::vector<std::string>& digests);
+
+
+// split_digests splits a list of digest names or values at digestSeparator
+std::vector<std::string> split_digests(const std::string& digests);
 
 #endif
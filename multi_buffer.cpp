@@ -0,0 +1,392 @@
+// this file implements multi-buffer MD5 (RFC 1321) and SHA-1 (FIPS 180-4)
+//
+// (C) Markus Dittrich, 2015
+
+#include <cstdint>
+#include <cstring>
+
+#include "digest.hpp"
+#include "multi_buffer.hpp"
+
+
+static const size_t blockLen = 64;
+
+
+static inline uint32_t load32_le(const unsigned char* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8
+    | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+
+static inline uint32_t load32_be(const unsigned char* p) {
+  return static_cast<uint32_t>(p[3]) | static_cast<uint32_t>(p[2]) << 8
+    | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[0]) << 24;
+}
+
+
+// HashMessagesFunc hashes count messages and stores the raw digests
+// consecutively in out
+using HashMessagesFunc = void (*)(const Message* messages, size_t count,
+  unsigned char* out);
+
+struct MultiBufferKernel {
+  HashMessagesFunc md5;
+  HashMessagesFunc sha1;
+  const char* name;
+};
+
+static MultiBufferKernel select_kernel();
+static const MultiBufferKernel kernel = select_kernel();
+
+
+#if defined(__x86_64__)
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+
+template <typename V>
+static ALWAYS_INLINE void rotl_vec(V& x, int n) {
+  x = (x << n) | (x >> (32 - n));
+}
+
+
+// Md5 describes MD5 for the multi-buffer driver
+struct Md5 {
+
+  static const int stateWords = 4;
+  static const int digestLen = 16;
+  static const bool bigEndian = false;
+
+  static uint32_t iv(int i) {
+    static const uint32_t init[stateWords] = {
+      0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+    };
+    return init[i];
+  }
+
+  template <typename V>
+  static ALWAYS_INLINE void compress(V* h, const V* m) {
+    static const uint32_t k[64] = {
+      0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+      0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+      0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+      0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+      0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+      0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+      0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+      0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+      0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+      0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+      0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+    };
+    static const int s[4][4] = {
+      {7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}
+    };
+
+    V a = h[0];
+    V b = h[1];
+    V c = h[2];
+    V d = h[3];
+    for (int i = 0; i < 64; ++i) {
+      V f;
+      int g;
+      int round = i / 16;
+      if (round == 0) {
+        f = d ^ (b & (c ^ d));
+        g = i;
+      } else if (round == 1) {
+        f = c ^ (d & (b ^ c));
+        g = (5*i + 1) % 16;
+      } else if (round == 2) {
+        f = b ^ c ^ d;
+        g = (3*i + 5) % 16;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7*i) % 16;
+      }
+      V x = a + f + k[i] + m[g];
+      rotl_vec(x, s[round][i % 4]);
+      a = d;
+      d = c;
+      c = b;
+      b = b + x;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+  }
+};
+
+
+// Sha1 describes SHA-1 for the multi-buffer driver
+struct Sha1 {
+
+  static const int stateWords = 5;
+  static const int digestLen = 20;
+  static const bool bigEndian = true;
+
+  static uint32_t iv(int i) {
+    static const uint32_t init[stateWords] = {
+      0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+    };
+    return init[i];
+  }
+
+  template <typename V>
+  static ALWAYS_INLINE void compress(V* h, const V* m) {
+    V w[16];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = m[i];
+    }
+
+    V a = h[0];
+    V b = h[1];
+    V c = h[2];
+    V d = h[3];
+    V e = h[4];
+    for (int t = 0; t < 80; ++t) {
+      if (t >= 16) {
+        V x = w[(t-3) % 16] ^ w[(t-8) % 16] ^ w[(t-14) % 16] ^ w[t % 16];
+        rotl_vec(x, 1);
+        w[t % 16] = x;
+      }
+      V f;
+      uint32_t k;
+      if (t < 20) {
+        f = d ^ (b & (c ^ d));
+        k = 0x5a827999;
+      } else if (t < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (t < 60) {
+        f = (b & c) | (d & (b | c));
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      V tmp = a;
+      rotl_vec(tmp, 5);
+      tmp += f + e + k + w[t % 16];
+      e = d;
+      d = c;
+      rotl_vec(b, 30);
+      c = b;
+      b = a;
+      a = tmp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+};
+
+
+// Lane tracks the message currently hashed in a vector lane. Full blocks
+// are read in place; the padded final block(s) are assembled in tail.
+struct Lane {
+  const unsigned char* data;
+  size_t fullBlocks;
+  size_t numBlocks;
+  size_t block;
+  size_t message;
+  bool active;
+  unsigned char tail[2*blockLen];
+};
+
+
+// load_lane assigns message index to lane l and resets its state
+template <typename Alg, typename V>
+static ALWAYS_INLINE void load_lane(Lane& lane, int l, V* h,
+  const Message* messages, size_t index) {
+
+  const Message& msg = messages[index];
+  lane.data = msg.data;
+  lane.fullBlocks = msg.size / blockLen;
+  lane.block = 0;
+  lane.message = index;
+  lane.active = true;
+
+  // padding: 0x80, zeros and the message length in bits
+  size_t rem = msg.size % blockLen;
+  size_t tailLen = rem + 9 <= blockLen ? blockLen : 2*blockLen;
+  memset(lane.tail, 0, tailLen);
+  if (rem > 0) {
+    memcpy(lane.tail, msg.data + lane.fullBlocks*blockLen, rem);
+  }
+  lane.tail[rem] = 0x80;
+  uint64_t bits = static_cast<uint64_t>(msg.size) * 8;
+  for (int i = 0; i < 8; ++i) {
+    int shift = Alg::bigEndian ? 56 - 8*i : 8*i;
+    lane.tail[tailLen - 8 + i] = static_cast<unsigned char>(bits >> shift);
+  }
+  lane.numBlocks = lane.fullBlocks + tailLen / blockLen;
+
+  for (int w = 0; w < Alg::stateWords; ++w) {
+    h[w][l] = Alg::iv(w);
+  }
+}
+
+
+// hash_messages_vec hashes count messages keeping one message per lane of
+// the vector type V
+template <typename Alg, typename V, int N>
+static ALWAYS_INLINE void hash_messages_vec(const Message* messages,
+  size_t count, unsigned char* out) {
+
+  V h[Alg::stateWords];
+  Lane lanes[N];
+  size_t next = 0;
+  int active = 0;
+  for (int l = 0; l < N; ++l) {
+    lanes[l].active = false;
+    if (next < count) {
+      load_lane<Alg>(lanes[l], l, h, messages, next++);
+      ++active;
+    }
+  }
+
+  while (active > 0) {
+    // transpose the next block of each lane into the message vectors;
+    // idle lanes hash zeros whose result is never used
+    V m[16];
+    for (int l = 0; l < N; ++l) {
+      const Lane& lane = lanes[l];
+      if (!lane.active) {
+        for (int w = 0; w < 16; ++w) {
+          m[w][l] = 0;
+        }
+        continue;
+      }
+      const unsigned char* p = lane.block < lane.fullBlocks
+        ? lane.data + lane.block*blockLen
+        : lane.tail + (lane.block - lane.fullBlocks)*blockLen;
+      for (int w = 0; w < 16; ++w) {
+        m[w][l] = Alg::bigEndian ? load32_be(p + 4*w) : load32_le(p + 4*w);
+      }
+    }
+
+    Alg::compress(h, m);
+
+    for (int l = 0; l < N; ++l) {
+      Lane& lane = lanes[l];
+      if (!lane.active || ++lane.block < lane.numBlocks) {
+        continue;
+      }
+      unsigned char* digest = out + lane.message * Alg::digestLen;
+      for (int w = 0; w < Alg::stateWords; ++w) {
+        uint32_t v = h[w][l];
+        for (int i = 0; i < 4; ++i) {
+          int shift = Alg::bigEndian ? 24 - 8*i : 8*i;
+          digest[4*w + i] = static_cast<unsigned char>(v >> shift);
+        }
+      }
+      lane.active = false;
+      --active;
+      if (next < count) {
+        load_lane<Alg>(lane, l, h, messages, next++);
+        ++active;
+      }
+    }
+  }
+}
+
+
+static void md5_sse2(const Message* messages, size_t count, unsigned char* out) {
+  hash_messages_vec<Md5, u32x4, 4>(messages, count, out);
+}
+
+
+static void sha1_sse2(const Message* messages, size_t count, unsigned char* out) {
+  hash_messages_vec<Sha1, u32x4, 4>(messages, count, out);
+}
+
+
+__attribute__((target("avx2")))
+static void md5_avx2(const Message* messages, size_t count, unsigned char* out) {
+  hash_messages_vec<Md5, u32x8, 8>(messages, count, out);
+}
+
+
+__attribute__((target("avx2")))
+static void sha1_avx2(const Message* messages, size_t count, unsigned char* out) {
+  hash_messages_vec<Sha1, u32x8, 8>(messages, count, out);
+}
+
+
+__attribute__((target("avx512f")))
+static void md5_avx512(const Message* messages, size_t count, unsigned char* out) {
+  hash_messages_vec<Md5, u32x16, 16>(messages, count, out);
+}
+
+
+__attribute__((target("avx512f")))
+static void sha1_avx512(const Message* messages, size_t count, unsigned char* out) {
+  hash_messages_vec<Sha1, u32x16, 16>(messages, count, out);
+}
+#endif
+
+
+// select_kernel picks the widest multi-buffer kernel supported by the CPU.
+// Without vector support messages are hashed one by one with openssl.
+static MultiBufferKernel select_kernel() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {md5_avx512, sha1_avx512, "avx512"};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return {md5_avx2, sha1_avx2, "avx2"};
+  }
+  return {md5_sse2, sha1_sse2, "sse2"};
+#else
+  return {nullptr, nullptr, "openssl"};
+#endif
+}
+
+
+// has_multi_buffer returns true if digest name has a multi-buffer kernel
+bool has_multi_buffer(const std::string& name) {
+  return name == "md5" || name == "sha1";
+}
+
+
+// multi_buffer_hash computes digest name of all messages and stores the hex
+// encoded digests in hashes (in message order)
+void multi_buffer_hash(const std::string& name,
+  const std::vector<Message>& messages, std::vector<std::string>& hashes) {
+
+  hashes.resize(messages.size());
+  HashMessagesFunc func = name == "md5" ? kernel.md5 : kernel.sha1;
+  if (func == nullptr) {
+    EvpDigest digest(evp_digest(name));
+    for (size_t i = 0; i < messages.size(); ++i) {
+      digest.reset();
+      digest.update(reinterpret_cast<const char*>(messages[i].data),
+        messages[i].size);
+      hashes[i] = digest.final();
+    }
+    return;
+  }
+
+  size_t digestLen = name == "md5" ? 16 : 20;
+  std::vector<unsigned char> raw(messages.size() * digestLen);
+  func(messages.data(), messages.size(), raw.data());
+  for (size_t i = 0; i < messages.size(); ++i) {
+    hashes[i].clear();
+    append_hex(hashes[i], raw.data() + i*digestLen, digestLen);
+  }
+}
+
+
+// multi_buffer_implementation returns the name of the kernel selected for
+// this CPU
+const char* multi_buffer_implementation() {
+  return kernel.name;
+}
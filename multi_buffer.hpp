@@ -0,0 +1,39 @@
+// this file implements multi-buffer MD5 and SHA-1. Both digests are serial
+// within a message, but independent messages can be hashed in parallel by
+// keeping one message per vector lane. The kernels are written once with gcc
+// vector extensions and instantiated for SSE2 (4 lanes), AVX2 (8 lanes) and
+// AVX-512 (16 lanes); the widest one supported by the CPU is picked at
+// runtime. Lanes are refilled with the next message as soon as their
+// current one is done so messages of different lengths keep all lanes busy.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef MULTI_BUFFER_HPP
+#define MULTI_BUFFER_HPP
+
+#include <string>
+#include <vector>
+
+
+// Message is a complete message held in memory
+struct Message {
+  const unsigned char* data;
+  size_t size;
+};
+
+
+// has_multi_buffer returns true if digest name has a multi-buffer kernel
+bool has_multi_buffer(const std::string& name);
+
+
+// multi_buffer_hash computes digest name of all messages and stores the hex
+// encoded digests in hashes (in message order)
+void multi_buffer_hash(const std::string& name,
+  const std::vector<Message>& messages, std::vector<std::string>& hashes);
+
+
+// multi_buffer_implementation returns the name of the kernel selected for
+// this CPU
+const char* multi_buffer_implementation();
+
+#endif
@@ -0,0 +1,118 @@
+// this file implements phantom's buffered result output
+//
+// (C) Markus Dittrich, 2015
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+
+#include "output.hpp"
+#include "util.hpp"
+
+
+OutputBuffer::OutputBuffer(bool sorted, const std::string& tmpDir, int fd,
+  size_t capacity) : fd_(fd), buf_(capacity) {
+
+  if (sorted) {
+    sorter_ = std::make_unique<RunSorter>(tmpDir);
+  }
+}
+
+
+OutputBuffer::~OutputBuffer() {
+  flush();
+}
+
+
+// add_line adds line (without trailing newline) for the file at path
+void OutputBuffer::add_line(const std::string& path, const std::string& line) {
+  if (sorter_) {
+    sorter_->add(path, line);
+    return;
+  }
+  append(line.data(), line.size());
+  append("\n", 1);
+}
+
+
+// finish writes out all remaining lines
+void OutputBuffer::finish() {
+  if (sorter_) {
+    sorter_->finish();
+    std::string path;
+    std::string line;
+    while (sorter_->next(path, line)) {
+      append(line.data(), line.size());
+      append("\n", 1);
+    }
+    sorter_.reset();
+  }
+  flush();
+}
+
+
+void OutputBuffer::append(const char* s, size_t size) {
+  while (size > 0) {
+    if (fill_ == buf_.size()) {
+      flush();
+    }
+    size_t n = std::min(size, buf_.size() - fill_);
+    memcpy(buf_.data() + fill_, s, n);
+    fill_ += n;
+    s += n;
+    size -= n;
+  }
+}
+
+
+// flush writes the buffer content to the file descriptor
+void OutputBuffer::flush() {
+  size_t done = 0;
+  while (done < fill_) {
+    ssize_t n = write(fd_, buf_.data() + done, fill_ - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      error("failed to write output");
+    }
+    done += n;
+  }
+  fill_ = 0;
+}
+
+
+// append_int appends the decimal representation of v to out
+void append_int(std::string& out, unsigned long long v) {
+  char digits[24];
+  char* p = digits + sizeof(digits);
+  do {
+    *--p = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+  out.append(p, digits + sizeof(digits) - p);
+}
+
+
+void append_int(std::string& out, long long v) {
+  if (v < 0) {
+    out.push_back('-');
+    append_int(out, 0ULL - static_cast<unsigned long long>(v));
+    return;
+  }
+  append_int(out, static_cast<unsigned long long>(v));
+}
+
+
+// append_meta appends the metadata portion of a phantom output line to out
+void append_meta(std::string& out, const FileMeta& meta) {
+  append_int(out, meta.size);
+  out.append(" , ");
+  append_int(out, meta.mtime);
+  out.append(" , ");
+  append_int(out, meta.ctime);
+  out.append(" , ");
+  append_int(out, meta.ino);
+  out.append(" , ");
+  append_int(out, meta.dev);
+}
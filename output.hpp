@@ -0,0 +1,66 @@
+// this file implements phantom's buffered result output. Lines are collected
+// in a large preallocated buffer which is written out with a single write()
+// once full instead of going through std::cout line by line. In sorted mode
+// lines are instead handed to an external sorter keyed by path and written
+// in path order at the end, which makes the output of repeated runs over an
+// unchanged tree byte-identical.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "refParser.hpp"
+#include "runs.hpp"
+
+
+// default size of the output buffer in bytes
+const size_t defaultOutputBufferSize = 1024*1024;
+
+
+// OutputBuffer writes output lines to a file descriptor in large blocks
+class OutputBuffer {
+
+public:
+
+  // in sorted mode lines are sorted via sort runs in tmpDir
+  OutputBuffer(bool sorted, const std::string& tmpDir, int fd = STDOUT_FILENO,
+    size_t capacity = defaultOutputBufferSize);
+  ~OutputBuffer();
+
+  OutputBuffer(const OutputBuffer& o) = delete;
+  OutputBuffer& operator=(const OutputBuffer& o) = delete;
+
+  // add_line adds line (without trailing newline) for the file at path
+  void add_line(const std::string& path, const std::string& line);
+
+  // finish writes out all remaining lines
+  void finish();
+
+private:
+
+  void append(const char* s, size_t size);
+  void flush();
+
+  int fd_;
+  std::vector<char> buf_;
+  size_t fill_ = 0;
+  std::unique_ptr<RunSorter> sorter_;
+};
+
+
+// append_int appends the decimal representation of v to out
+void append_int(std::string& out, long long v);
+void append_int(std::string& out, unsigned long long v);
+
+
+// append_meta appends the metadata portion of a phantom output line to out
+void append_meta(std::string& out, const FileMeta& meta);
+
+#endif
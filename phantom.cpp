@@ -7,14 +7,21 @@
 // (C) Markus Dittrich 2015
 
 #include <openssl/evp.h>
+#include <sys/stat.h>
 
 #include <chrono>
 #include <iostream>
 #include <vector>
 
+#include "checkpoint.hpp"
 #include "cmdline.hpp"
+#include "duplicates.hpp"
 #include "hash.hpp"
+#include "progress.hpp"
 #include "refParser.hpp"
+#include "refdb.hpp"
+#include "shard.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 #include "worker.hpp"
 
@@ -30,36 +37,158 @@ int main(int argc, char** argv) {
   OpenSSL_add_all_digests();
 
   auto cmdlOpts = parse_cmdline(argc, argv);
+
+  // SIGUSR1 requests a progress report; only the reporter thread takes it
+  ProgressReporter::block_signals();
+
+  // convert between text and binary reference formats
+  if (!cmdlOpts.convertPath.empty()) {
+    auto db = load_reference_data(cmdlOpts.convertPath);
+    if (!db.valid()) {
+      error("Failed to parse reference data file");
+    }
+    if (cmdlOpts.outputDbPath.empty()) {
+      write_text(db, std::cout);
+    } else {
+      db.write(cmdlOpts.outputDbPath);
+    }
+    EVP_cleanup();
+    return 0;
+  }
+
+  // combine the manifests of a sharded scan
+  if (cmdlOpts.merge) {
+    merge_manifests(cmdlOpts);
+    EVP_cleanup();
+    return 0;
+  }
+
+  // tracing has to be switched on before any of the traced threads start
+  if (!cmdlOpts.traceFile.empty()) {
+    traceEnabled = true;
+  }
+
+  // in streaming mode the reference is read during the final merge
   RefData refData;
-  if (cmdlOpts.compareToRef) {
-    refData.refMap = load_reference_data(cmdlOpts.referenceFilePath);
-    if (refData.refMap.empty()) {
+  if (cmdlOpts.compareToRef && !cmdlOpts.streaming) {
+    refData.refDb = load_reference_data(cmdlOpts.referenceFilePath);
+    if (refData.refDb.empty()) {
       error("Failed to parse reference data file");
     }
+    refData.visited.reset(refData.refDb.size());
   }
 
-  // initialize queue with root path
-  StringQueue fileQueue(cmdlOpts.numThreads);
-  fileQueue.push(cmdlOpts.rootPath);
+  // set up the pipeline queues and seed them with the root path
+  StringWSQueue dirQueue(cmdlOpts.walkThreads);
+  FileQueue fileQueue("file queue", defaultStageQueueSize);
+  ResultQueue resultQueue("result queue", defaultStageQueueSize);
+
+  // with an elevator, hash threads take files from the disk queue which is
+  // kept short so files are dispatched as late as possible. Device groups
+  // have their own queues (and elevators).
+  bool useElevator = !cmdlOpts.elevator.empty() && !cmdlOpts.deviceGroups
+    && !cmdlOpts.duplicates;
+  FileQueue diskQueue("disk queue", 2 * cmdlOpts.hashThreads);
+
+  struct stat info;
+  if (lstat(cmdlOpts.rootPath.c_str(), &info) < 0) {
+    error("failed to access " + cmdlOpts.rootPath);
+  }
+  if (S_ISDIR(info.st_mode)) {
+    dirQueue.push(0, std::string(cmdlOpts.rootPath));
+  } else if (S_ISREG(info.st_mode) && (!cmdlOpts.shard.enabled()
+      || cmdlOpts.shard.owns(cmdlOpts.rootPath))) {
+    fileQueue.push(FileEntry(cmdlOpts.rootPath));
+  }
+
+  // the journal is opened before any work is started so a resumed scan
+  // sees all results of the previous run
+  Checkpoint checkpoint;
+  if (!cmdlOpts.checkpointPath.empty()) {
+    try {
+      checkpoint.open(cmdlOpts.checkpointPath, cmdlOpts.resume,
+        cmdlOpts.hashMethod, cmdlOpts.checkpointInterval);
+    } catch (std::runtime_error& e) {
+      error(e.what());
+    }
+  }
+  if (cmdlOpts.timeBudget > 0) {
+    set_time_budget(cmdlOpts.timeBudget);
+  }
 
   Printer printer;
+  InodeTable inodes;
   Stats stats(std::chrono::system_clock::now());
-  std::vector<std::thread> threads;
-  for (int i=0; i < cmdlOpts.numThreads; ++i) {
-    threads.push_back(std::thread(worker, std::ref(fileQueue), std::ref(printer),
-      std::ref(refData), std::ref(stats), std::ref(cmdlOpts)));
+  ProgressReporter progress(stats, printer, cmdlOpts.progressInterval,
+    cmdlOpts.statusFile, {
+      {"file queue", [&]() { return fileQueue.size(); }},
+      {"disk queue", [&]() { return diskQueue.size(); }},
+      {"result queue", [&]() { return resultQueue.size(); }}
+    });
+  if (!refData.refDb.empty()) {
+    progress.set_total(refData.refDb.size());
+  }
+  std::vector<std::thread> walkers;
+  for (int i=0; i < cmdlOpts.walkThreads; ++i) {
+    walkers.push_back(std::thread(walker, std::ref(dirQueue), i,
+      std::ref(fileQueue), std::cref(cmdlOpts.shard), std::ref(printer)));
   }
 
-  // wait for threads to finish
-  for (auto& t : threads) {
+  std::thread elevator;
+  std::vector<std::thread> hashers;
+  if (cmdlOpts.duplicates) {
+    hashers.push_back(std::thread(duplicate_worker, std::ref(fileQueue),
+      std::cref(printer), std::ref(stats), std::cref(cmdlOpts)));
+  } else if (cmdlOpts.deviceGroups) {
+    hashers.push_back(std::thread(device_worker, std::ref(fileQueue),
+      std::ref(resultQueue), std::ref(printer), std::ref(refData),
+      std::ref(inodes), std::ref(checkpoint), std::ref(stats),
+      std::ref(cmdlOpts)));
+  } else {
+    if (useElevator) {
+      elevator = std::thread(elevator_worker, std::ref(fileQueue),
+        std::ref(diskQueue), std::cref(cmdlOpts));
+    }
+    FileQueue& hashQueue = useElevator ? diskQueue : fileQueue;
+    for (int i=0; i < cmdlOpts.hashThreads; ++i) {
+      hashers.push_back(std::thread(hash_worker, std::ref(hashQueue),
+        std::ref(resultQueue), std::ref(printer), std::ref(refData),
+        std::ref(inodes), std::ref(checkpoint), std::ref(stats),
+        std::ref(cmdlOpts)));
+    }
+  }
+  std::thread output(output_worker, std::ref(resultQueue), std::ref(printer),
+    std::ref(refData), std::ref(stats), std::ref(cmdlOpts));
+
+  // wait for the stages to finish one after the other
+  for (auto& t : walkers) {
+    t.join();
+  }
+  progress.set_total(fileQueue.pushed());
+  fileQueue.close();
+  if (useElevator) {
+    elevator.join();
+    diskQueue.close();
+  }
+  for (auto& t : hashers) {
     t.join();
   }
+  resultQueue.close();
+  output.join();
+  checkpoint.close();
+  stats.add_queue_stats(fileQueue.stats());
+  if (useElevator) {
+    stats.add_queue_stats(diskQueue.stats());
+  }
+  stats.add_queue_stats(resultQueue.stats());
 
-  // check for disappeared files
-  for (const auto& e : refData.refMap) {
-    if (refData.fileMap.find(e.first) == refData.fileMap.end()) {
-      std::cout << "file disappeared:  " << e.first << "\n";
-    }
+  // check for disappeared files (unless the scan was stopped early and did
+  // not visit all of them)
+  bool stopped = scan_stopped();
+  if (!stopped) {
+    refData.visited.for_each_unset([&](size_t i) {
+      std::cout << "file disappeared:  " << refData.refDb.path(i) << "\n";
+    });
   }
 
   // print final statistics
@@ -67,6 +196,24 @@ int main(int argc, char** argv) {
     print_stats(stats);
   }
 
+  if (!cmdlOpts.traceFile.empty()) {
+    try {
+      write_trace(cmdlOpts.traceFile);
+    } catch (std::runtime_error& e) {
+      error(e.what());
+    }
+    print_trace_summary(std::cerr);
+  }
+
   // cleanup openssl
   EVP_cleanup();
+
+  if (stopped) {
+    std::cerr << "time budget used up, scan incomplete";
+    if (checkpoint.enabled()) {
+      std::cerr << " (continue with --resume)";
+    }
+    std::cerr << "\n";
+    return 2;
+  }
 }
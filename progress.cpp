@@ -0,0 +1,125 @@
+// ProgressReporter periodically reports the progress of a phantom run
+//
+// (C) Markus Dittrich 2015
+
+#include <signal.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "progress.hpp"
+
+
+// interval at which the reporter checks for shutdown
+static const std::chrono::milliseconds pollInterval(100);
+
+
+ProgressReporter::ProgressReporter(const Stats& stats, const Printer& printer,
+  double interval, const std::string& statusFile, std::vector<QueueProbe> queues)
+  : stats_(stats), printer_(printer), interval_(interval),
+    statusFile_(statusFile), queues_(std::move(queues)) {
+
+  thread_ = std::thread(&ProgressReporter::run, this);
+}
+
+
+ProgressReporter::~ProgressReporter() {
+  done_ = true;
+  thread_.join();
+}
+
+
+// set_total sets the total number of files used for the ETA once known
+void ProgressReporter::set_total(long long total) {
+  total_ = total;
+}
+
+
+// block_signals blocks SIGUSR1 in the calling thread
+void ProgressReporter::block_signals() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+
+// run waits for SIGUSR1 or the next report interval until shut down
+void ProgressReporter::run() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+
+  using clock = std::chrono::steady_clock;
+  auto interval = std::chrono::duration_cast<clock::duration>(
+    std::chrono::duration<double>(interval_));
+  auto next = clock::now() + interval;
+  while (!done_) {
+    auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(pollInterval);
+    if (interval_ > 0) {
+      wait = std::max(std::chrono::nanoseconds(0),
+        std::min(wait, std::chrono::duration_cast<std::chrono::nanoseconds>(
+          next - clock::now())));
+    }
+    struct timespec timeout;
+    timeout.tv_sec = wait.count() / 1000000000;
+    timeout.tv_nsec = wait.count() % 1000000000;
+    if (sigtimedwait(&set, NULL, &timeout) == SIGUSR1) {
+      report();
+    }
+    if (interval_ > 0 && clock::now() >= next) {
+      report();
+      next += interval;
+    }
+  }
+}
+
+
+// report writes a single progress line
+void ProgressReporter::report() {
+  auto elapsed = std::chrono::duration<double>(
+    std::chrono::system_clock::now() - stats_.startTime()).count();
+  auto files = stats_.num_files() + stats_.num_trusted() + stats_.num_linked()
+    + stats_.num_resumed();
+  auto mb = stats_.num_bytes()/1024.0/1024.0;
+
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(2)
+     << "progress        : " << elapsed << " s, "
+     << files << " files (" << (elapsed > 0 ? files/elapsed : 0.0) << " files/s), "
+     << mb << " MB (" << (elapsed > 0 ? mb/elapsed : 0.0) << " MB/s)";
+  for (const auto& q : queues_) {
+    os << ", " << q.name << " " << q.depth();
+  }
+
+  long long total = total_;
+  if (total >= files && files > 0 && elapsed > 0) {
+    os << ", ETA " << std::setprecision(0) << (total - files) / (files/elapsed)
+       << " s";
+  } else {
+    os << ", ETA unknown";
+  }
+
+  if (statusFile_.empty()) {
+    printer_.cerr(os.str());
+    return;
+  }
+
+  // replace the status file atomically so readers never see partial lines
+  auto tmp = statusFile_ + ".tmp";
+  {
+    std::ofstream status(tmp, std::ios::trunc);
+    status << os.str() << "\n";
+    if (!status) {
+      printer_.cerr("failed to write status file " + tmp);
+      return;
+    }
+  }
+  if (rename(tmp.c_str(), statusFile_.c_str()) != 0) {
+    printer_.cerr("failed to write status file " + statusFile_);
+  }
+}
@@ -0,0 +1,64 @@
+// ProgressReporter periodically reports the progress of a phantom run
+// (files and data processed, rates, queue depths and an ETA) to stderr or a
+// status file. A report can also be requested at any time by sending
+// SIGUSR1 to the process.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stats.hpp"
+#include "util.hpp"
+
+
+// QueueProbe gives the progress reporter access to the depth of a queue
+struct QueueProbe {
+  std::string name;
+  std::function<size_t()> depth;
+};
+
+
+class ProgressReporter {
+
+public:
+
+  // reports every interval seconds (only on SIGUSR1 if interval is 0) to
+  // statusFile or to stderr if statusFile is empty
+  ProgressReporter(const Stats& stats, const Printer& printer, double interval,
+    const std::string& statusFile, std::vector<QueueProbe> queues);
+  ~ProgressReporter();
+
+  ProgressReporter(const ProgressReporter& p) = delete;
+  ProgressReporter& operator=(const ProgressReporter& p) = delete;
+
+  // set_total sets the total number of files used for the ETA once known
+  void set_total(long long total);
+
+  // block_signals blocks SIGUSR1 in the calling thread. It has to be called
+  // before any other threads are started so they inherit the signal mask
+  // and the signal is only picked up by the reporter.
+  static void block_signals();
+
+private:
+
+  void run();
+  void report();
+
+  const Stats& stats_;
+  const Printer& printer_;
+  double interval_;
+  std::string statusFile_;
+  std::vector<QueueProbe> queues_;
+  std::atomic<long long> total_{-1};
+  std::atomic<bool> done_{false};
+  std::thread thread_;
+};
+
+#endif
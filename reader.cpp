@@ -0,0 +1,436 @@
+// this file implements the different read engines phantom can use to pull
+// file content into memory for hashing
+//
+// (C) Markus Dittrich, 2015
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "reader.hpp"
+#include "trace.hpp"
+#include "uring.hpp"
+#include "util.hpp"
+
+
+// traced_pread is a pread which is accounted to the read trace stage
+static inline ssize_t traced_pread(int fd, char* buf, size_t count,
+  off_t offset) {
+  TraceScope ts(TraceStage::read);
+  return pread(fd, buf, count, offset);
+}
+
+
+// Prefetcher opens the next file to be read ahead of time and asks the
+// kernel to start reading its first window in the background
+class Prefetcher {
+
+public:
+
+  Prefetcher(size_t window) : window_(window) {};
+
+  void prefetch(const FileEntry& file) {
+    fd_.reset();
+    file_ = file;
+    try {
+      fd_ = std::make_unique<Fd>(file, O_RDONLY);
+    } catch (FailedFileAccess& e) {
+      return;
+    }
+    struct stat info;
+    if (fstat(fd_->get(), &info) < 0 || !S_ISREG(info.st_mode)) {
+      fd_.reset();
+      return;
+    }
+    posix_fadvise(fd_->get(), 0, window_, POSIX_FADV_WILLNEED);
+  }
+
+  // open returns the prefetched descriptor for file if available or opens
+  // the file otherwise
+  std::unique_ptr<Fd> open(const FileEntry& file) {
+    if (fd_ && file == file_) {
+      return std::move(fd_);
+    }
+    return std::make_unique<Fd>(file, O_RDONLY);
+  }
+
+private:
+
+  size_t window_;
+  FileEntry file_;
+  std::unique_ptr<Fd> fd_;
+};
+
+
+// BufferedReader reads files via read(2) into a large aligned buffer. If
+// direct is set, files are opened with O_DIRECT bypassing the page cache
+class BufferedReader : public ReadEngine {
+
+public:
+
+  BufferedReader(size_t bufSize, bool direct)
+    : buffer_(bufSize), direct_(direct), name_(direct ? "direct" : "read") {};
+
+  void read_file(const FileEntry& file, const ReadConsumer& consume) override {
+    Fd fd(file, direct_ ? O_RDONLY | O_DIRECT : O_RDONLY);
+    ssize_t nread;
+    while ((nread = read_full(fd.get(), buffer_.get(), buffer_.size())) > 0) {
+      consume(buffer_.get(), nread);
+    }
+    if (nread < 0) {
+      throw FailedFileAccess(file.path());
+    }
+  }
+
+  const std::string& name() const override { return name_; }
+
+private:
+
+  // read_full fills buf until either size bytes are read or EOF is hit. This
+  // keeps digest updates at buffer granularity even for short reads.
+  ssize_t read_full(int fd, char* buf, size_t size) {
+    TraceScope ts(TraceStage::read);
+    size_t total = 0;
+    while (total < size) {
+      ssize_t n = read(fd, buf + total, size - total);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return -1;
+      } else if (n == 0) {
+        break;
+      }
+      total += n;
+      // with O_DIRECT a short read means we hit EOF; a further read at the
+      // unaligned offset would fail with EINVAL
+      if (direct_ && total % bufferAlignment != 0) {
+        break;
+      }
+    }
+    return total;
+  }
+
+  AlignedBuffer buffer_;
+  bool direct_;
+  const std::string name_;
+};
+
+
+// MmapReader maps files into memory and hands the mapping to the consumer in
+// one go. The kernel is advised of sequential access for aggressive readahead.
+class MmapReader : public ReadEngine {
+
+public:
+
+  void read_file(const FileEntry& file, const ReadConsumer& consume) override {
+    Fd fd(file, O_RDONLY);
+    struct stat info;
+    if (fstat(fd.get(), &info) < 0) {
+      throw FailedFileAccess(file.path());
+    }
+    if (info.st_size == 0) {
+      return;
+    }
+
+    // page faults are taken while hashing and hence show up as digest time
+    void* addr;
+    {
+      TraceScope ts(TraceStage::read);
+      addr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+      if (addr == MAP_FAILED) {
+        throw FailedFileAccess(file.path());
+      }
+      madvise(addr, info.st_size, MADV_SEQUENTIAL);
+    }
+    consume(static_cast<const char*>(addr), info.st_size);
+    munmap(addr, info.st_size);
+  }
+
+  const std::string& name() const override { return name_; }
+
+private:
+
+  const std::string name_ = "mmap";
+};
+
+
+// ReadaheadReader reads files via read(2) while continuously advising the
+// kernel (via posix_fadvise(WILLNEED)) to fetch the window ahead of the
+// current read position. It serves as fallback for the async mode on systems
+// without io_uring.
+class ReadaheadReader : public ReadEngine {
+
+public:
+
+  ReadaheadReader(size_t bufSize, unsigned int depth)
+    : buffer_(bufSize), window_(buffer_.size() * depth), prefetcher_(window_) {};
+
+  void read_file(const FileEntry& file, const ReadConsumer& consume) override {
+    auto fd = prefetcher_.open(file);
+    off_t offset = 0;
+    off_t advised = 0;
+    ssize_t nread;
+    while (true) {
+      if (offset + static_cast<off_t>(window_/2) >= advised) {
+        posix_fadvise(fd->get(), advised, window_, POSIX_FADV_WILLNEED);
+        advised += window_;
+      }
+      {
+        TraceScope ts(TraceStage::read);
+        nread = read(fd->get(), buffer_.get(), buffer_.size());
+      }
+      if (nread < 0 && errno == EINTR) {
+        continue;
+      } else if (nread <= 0) {
+        break;
+      }
+      consume(buffer_.get(), nread);
+      offset += nread;
+    }
+    if (nread < 0) {
+      throw FailedFileAccess(file.path());
+    }
+  }
+
+  void prefetch(const FileEntry& file) override {
+    prefetcher_.prefetch(file);
+  }
+
+  const std::string& name() const override { return name_; }
+
+private:
+
+  AlignedBuffer buffer_;
+  size_t window_;
+  Prefetcher prefetcher_;
+  const std::string name_ = "fadvise";
+};
+
+
+// UringReader keeps up to depth reads per file in flight via io_uring so
+// the kernel fetches upcoming chunks while the current one is being hashed.
+// Completed chunks are handed to the consumer strictly in file order.
+// If the ring fails while reads are in flight the kernel may still write
+// to the read buffer, so the buffer is given up and later files are read
+// with posix_fadvise readahead instead.
+class UringReader : public ReadEngine {
+
+public:
+
+  UringReader(std::unique_ptr<Uring> ring, size_t bufSize, unsigned int depth)
+    : ring_(std::move(ring)), buffer_(new AlignedBuffer(bufSize * depth)),
+      chunk_(bufSize), slots_(depth), prefetcher_(chunk_ * depth) {};
+
+  void read_file(const FileEntry& file, const ReadConsumer& consume) override {
+    if (fallback_) {
+      fallback_->read_file(file, consume);
+      return;
+    }
+    auto fd = prefetcher_.open(file);
+    struct stat info;
+    if (fstat(fd->get(), &info) < 0) {
+      throw FailedFileAccess(file.path());
+    }
+
+    // queue up the initial set of reads
+    off_t size = info.st_size;
+    off_t next = 0;
+    size_t inflight = 0;
+    for (auto& slot : slots_) {
+      slot.done = false;
+    }
+    for (size_t i = 0; i < slots_.size() && next < size; ++i) {
+      issue(fd->get(), i, next);
+      next += chunk_;
+      ++inflight;
+    }
+
+    // consume chunks in order and reissue the slot for the next chunk
+    bool failed = false;
+    bool eof = false;
+    size_t expected = 0;
+    while (inflight > 0) {
+      if (!wait_for(expected)) {
+        failed = true;
+        break;
+      }
+      auto& slot = slots_[expected];
+      slot.done = false;
+      --inflight;
+
+      if (slot.res < 0) {
+        failed = true;
+      } else if (!failed && !eof) {
+        char* buf = buffer_->get() + expected * chunk_;
+        ssize_t nread = slot.res;
+        // short reads in the middle of the file are completed synchronously
+        while (static_cast<size_t>(nread) < chunk_ && slot.offset + nread < size) {
+          ssize_t n = traced_pread(fd->get(), buf + nread, chunk_ - nread,
+            slot.offset + nread);
+          if (n < 0 && errno == EINTR) {
+            continue;
+          } else if (n <= 0) {
+            break;
+          }
+          nread += n;
+        }
+        if (nread > 0) {
+          consume(buf, nread);
+        }
+        if (static_cast<size_t>(nread) < chunk_) {
+          eof = true;
+        }
+      }
+
+      if (!failed && !eof && next < size) {
+        issue(fd->get(), expected, next);
+        next += chunk_;
+        ++inflight;
+      }
+      expected = (expected + 1) % slots_.size();
+    }
+
+    // drain reads still in flight after an error so buffers can be reused
+    while (inflight > 0 && ring_->submit(1)) {
+      unsigned long long id;
+      int res;
+      while (ring_->reap(id, res)) {
+        --inflight;
+      }
+    }
+    if (inflight > 0) {
+      retire();
+    }
+    if (failed) {
+      throw FailedFileAccess(file.path());
+    }
+
+    // pick up anything appended since fstat so we behave like a plain read
+    // loop
+    if (!eof) {
+      char* buf = buffer_->get();
+      ssize_t n;
+      while ((n = traced_pread(fd->get(), buf, chunk_, next)) != 0) {
+        if (n < 0 && errno == EINTR) {
+          continue;
+        } else if (n < 0) {
+          throw FailedFileAccess(file.path());
+        }
+        consume(buf, n);
+        next += n;
+      }
+    }
+  }
+
+  void prefetch(const FileEntry& file) override {
+    if (fallback_) {
+      fallback_->prefetch(file);
+      return;
+    }
+    prefetcher_.prefetch(file);
+  }
+
+  const std::string& name() const override {
+    return fallback_ ? fallback_->name() : name_;
+  }
+
+private:
+
+  struct Slot {
+    off_t offset;
+    int res;
+    bool done;
+  };
+
+  void issue(int fd, size_t slot, off_t offset) {
+    slots_[slot].offset = offset;
+    slots_[slot].done = false;
+    if (!ring_->prep_read(fd, buffer_->get() + slot * chunk_, chunk_, offset, slot)) {
+      error("io_uring submission queue overflow");
+    }
+  }
+
+  // wait_for submits pending reads and reaps completions until slot is done
+  bool wait_for(size_t slot) {
+    TraceScope ts(TraceStage::read);
+    while (!slots_[slot].done) {
+      if (!ring_->submit(1)) {
+        return false;
+      }
+      unsigned long long id;
+      int res;
+      while (ring_->reap(id, res)) {
+        slots_[id].res = res;
+        slots_[id].done = true;
+      }
+    }
+    return true;
+  }
+
+  // retire switches to the fallback engine. The buffer is leaked on purpose
+  // since reads that could not be drained may still complete into it; the
+  // ring itself is never used again so unsubmitted reads are never issued.
+  void retire() {
+    buffer_.release();
+    fallback_ = std::make_unique<ReadaheadReader>(chunk_, slots_.size());
+  }
+
+  std::unique_ptr<Uring> ring_;
+  std::unique_ptr<AlignedBuffer> buffer_;
+  size_t chunk_;
+  std::vector<Slot> slots_;
+  Prefetcher prefetcher_;
+  std::unique_ptr<ReadEngine> fallback_;
+  const std::string name_ = "io_uring";
+};
+
+
+// AlignedBuffer is a thin wrapper around a heap buffer with bufferAlignment
+// alignment. The size is rounded up to a multiple of the alignment.
+AlignedBuffer::AlignedBuffer(size_t size) {
+  size_ = ((size + bufferAlignment - 1) / bufferAlignment) * bufferAlignment;
+  if (posix_memalign(reinterpret_cast<void**>(&buf_), bufferAlignment, size_) != 0) {
+    error("failed to allocate aligned read buffer");
+  }
+}
+
+
+AlignedBuffer::~AlignedBuffer() {
+  free(buf_);
+}
+
+
+// is_read_mode returns true if mode names a known read engine
+bool is_read_mode(const std::string& mode) {
+  return mode == "async" || mode == "read" || mode == "mmap" || mode == "direct";
+}
+
+
+// make_read_engine returns the engine for the requested read mode using
+// buffers of (at least) bufSize bytes. If io_uring is not available the async
+// mode falls back to posix_fadvise based readahead.
+std::unique_ptr<ReadEngine> make_read_engine(const std::string& mode,
+  size_t bufSize, unsigned int depth) {
+
+  if (mode == "async") {
+    auto ring = std::make_unique<Uring>(depth);
+    if (ring->ok()) {
+      return std::make_unique<UringReader>(std::move(ring), bufSize, depth);
+    }
+    return std::make_unique<ReadaheadReader>(bufSize, depth);
+  } else if (mode == "read") {
+    return std::make_unique<BufferedReader>(bufSize, false);
+  } else if (mode == "direct") {
+    return std::make_unique<BufferedReader>(bufSize, true);
+  } else if (mode == "mmap") {
+    return std::make_unique<MmapReader>();
+  }
+  error("unknown read mode " + mode);
+  return nullptr;
+}
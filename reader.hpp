@@ -0,0 +1,85 @@
+// this file implements the different read engines phantom can use to pull
+// file content into memory for hashing
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef READER_HPP
+#define READER_HPP
+
+#include <cstdlib>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "util.hpp"
+
+
+// default size of the read buffer in bytes
+const size_t defaultBufferSize = 1024*1024;
+
+// alignment of read buffers (required for O_DIRECT)
+const size_t bufferAlignment = 4096;
+
+// default number of reads kept in flight per file by the async engine
+const unsigned int defaultQueueDepth = 4;
+
+
+// ReadConsumer is handed each chunk of file content as it becomes available
+using ReadConsumer = std::function<void(const char*, size_t)>;
+
+
+// ReadEngine is the common interface for all read strategies. Each thread
+// owns its own engine so engines are free to keep per thread buffers.
+class ReadEngine {
+
+public:
+
+  virtual ~ReadEngine() {};
+
+  // read_file streams the content of file through consume.
+  // Throws FailedFileAccess if the file can not be opened or read.
+  virtual void read_file(const FileEntry& file, const ReadConsumer& consume) = 0;
+
+  // prefetch hints that file will be read next. Engines which support it
+  // start pulling in data in the background.
+  virtual void prefetch(const FileEntry& file) { (void)file; };
+
+  // name of the read mode implemented by the engine
+  virtual const std::string& name() const = 0;
+};
+
+
+// AlignedBuffer is a thin wrapper around a heap buffer with bufferAlignment
+// alignment
+class AlignedBuffer {
+
+public:
+
+  AlignedBuffer(size_t size);
+  ~AlignedBuffer();
+
+  AlignedBuffer(const AlignedBuffer& ab) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer& ab) = delete;
+
+  char* get() const { return buf_; }
+  size_t size() const { return size_; }
+
+private:
+
+  char* buf_ = nullptr;
+  size_t size_;
+};
+
+
+// is_read_mode returns true if mode names a known read engine
+bool is_read_mode(const std::string& mode);
+
+
+// make_read_engine returns the engine for the requested read mode using
+// buffers of (at least) bufSize bytes. The async mode keeps up to depth reads
+// in flight per file.
+std::unique_ptr<ReadEngine> make_read_engine(const std::string& mode,
+  size_t bufSize, unsigned int depth);
+
+#endif
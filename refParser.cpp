@@ -5,47 +5,120 @@
 
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
 #include <vector>
 
+#include "hash.hpp"
 #include "refParser.hpp"
+#include "refdb.hpp"
 
 using VecString = std::vector<std::string>;
 
-static bool insert_line(const std::string& line, ReferenceMap& info);
+static bool insert_line(const std::string& line, RefDbBuilder& builder);
 static VecString split(const std::string& s, const std::string& delim);
 
 
-// load_reference_data parses a reference data set at filePath expected to be
-// in phantom style output format. It returns an unordered map from filepaths
-// to hash values
-ReferenceMap load_reference_data(const std::string& filePath) {
-
-  std::ifstream refFile(filePath);
-  if (!refFile) {
-    return ReferenceMap();
+// load_reference_data loads the reference at filePath which is either a
+// binary reference database or in phantom's text output format. Returns an
+// empty database on failure.
+RefDb load_reference_data(const std::string& filePath) {
+  try {
+    RefInput input(filePath);
+    if (input.binary()) {
+      return input.load();
+    }
+    RefDbBuilder builder;
+    if (!parse_reference_text(input.text(), builder)) {
+      return RefDb();
+    }
+    return builder.build();
+  } catch (std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return RefDb();
   }
+}
+
+
+// parse_reference_text parses a reference data set expected to be in
+// phantom style output format from in into builder
+bool parse_reference_text(std::istream& in, RefDbBuilder& builder) {
 
   std::string line;
-  ReferenceMap outMap;
-  while (getline(refFile, line)) {
-    if (!insert_line(line, outMap)) {
-      return ReferenceMap();
+  while (getline(in, line)) {
+    if (!insert_line(line, builder)) {
+      return false;
     }
   }
 
-  return outMap;
+  return true;
+}
+
+
+// meta_from_stat extracts the FileMeta tuple from a stat struct
+FileMeta meta_from_stat(const struct stat& info) {
+  FileMeta meta;
+  meta.size = info.st_size;
+  meta.mtime = info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+  meta.ctime = info.st_ctim.tv_sec * 1000000000LL + info.st_ctim.tv_nsec;
+  meta.ino = info.st_ino;
+  meta.dev = info.st_dev;
+  return meta;
+}
+
+
+// format_meta returns the metadata portion of a phantom output line
+std::string format_meta(const FileMeta& meta) {
+  return std::to_string(meta.size) + " , " + std::to_string(meta.mtime) + " , "
+    + std::to_string(meta.ctime) + " , " + std::to_string(meta.ino) + " , "
+    + std::to_string(meta.dev);
 }
 
 
-// insert_line parses a single line of a reference hash file and inserts it into
-// the reference map data structure. The line is expected to be in csv format
-// of the form:  <hash type>,  <file path>,  <file hash>
-bool insert_line(const std::string& line, ReferenceMap& map) {
+// insert_line parses a single line of a reference hash file and adds it to
+// the reference database builder
+bool insert_line(const std::string& line, RefDbBuilder& builder) {
+  std::string path;
+  RefEntry entry;
+  if (!parse_reference_line(line, path, entry)) {
+    return false;
+  }
+  return builder.add(path, entry);
+}
+
+
+// parse_reference_line parses a single line of a reference hash file. The
+// line is expected to be in csv format of the form:
+//   <hash types>,  <file path>,  <file hashes>,  <size>,  <mtime>,  <ctime>,
+//   <inode>,  <device>
+// Multiple hash types and hashes are separated by digestSeparator. The
+// metadata fields are optional to remain compatible with older reference
+// files.
+bool parse_reference_line(const std::string& line, std::string& path,
+  RefEntry& entry) {
   auto result = split(line, ", ");
-  if (result.size() != 3) {
+  if (result.size() != 3 && result.size() != 8) {
+    return false;
+  }
+  // every digest name needs its value (see RefDbBuilder::add)
+  if (split_digests(result[0]).size() != split_digests(result[2]).size()) {
     return false;
   }
-  map[result[1]] = result[2];
+  entry = RefEntry();
+  entry.method = result[0];
+  entry.hash = result[2];
+  if (result.size() == 8) {
+    try {
+      entry.meta.size = std::stoll(result[3]);
+      entry.meta.mtime = std::stoll(result[4]);
+      entry.meta.ctime = std::stoll(result[5]);
+      entry.meta.ino = std::stoull(result[6]);
+      entry.meta.dev = std::stoull(result[7]);
+    } catch (std::logic_error& e) {
+      return false;
+    }
+    entry.hasMeta = true;
+  }
+  path = std::move(result[1]);
   return true;
 }
 
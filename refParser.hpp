@@ -6,13 +6,67 @@
 #ifndef REFPARSER_HPP
 #define REFPARSER_HPP
 
+#include <sys/stat.h>
+
+#include <istream>
 #include <string>
-#include <unordered_map>
 
-using ReferenceMap = std::unordered_map<std::string, std::string>;
+
+class RefDb;
+class RefDbBuilder;
+
+
+// FileMeta holds the stat tuple used to decide if a file changed since the
+// reference was taken. Times are in ns since the epoch.
+struct FileMeta {
+  long long size = 0;
+  long long mtime = 0;
+  long long ctime = 0;
+  unsigned long long ino = 0;
+  unsigned long long dev = 0;
+
+  bool operator==(const FileMeta& m) const {
+    return size == m.size && mtime == m.mtime && ctime == m.ctime
+      && ino == m.ino && dev == m.dev;
+  }
+};
+
+
+// RefEntry is the reference data for a single file. Reference files written
+// by older phantom versions carry no metadata in which case hasMeta is false.
+// If a file was hashed with several digests, method and hash hold the
+// joined digest names and values, respectively.
+struct RefEntry {
+  std::string method;
+  std::string hash;
+  bool hasMeta = false;
+  FileMeta meta;
+};
+
+
+// load_reference_data loads the reference at filePath which is either a
+// binary reference database or in phantom's text output format. Returns an
+// invalid database (see RefDb::valid) on failure.
+RefDb load_reference_data(const std::string& filePath);
+
+
+// parse_reference_text parses the text format reference read from in into
+// builder. Returns false on failure.
+bool parse_reference_text(std::istream& in, RefDbBuilder& builder);
+
+
+// parse_reference_line parses a single line of a text format reference into
+// path and entry. Returns false if the line is malformed.
+bool parse_reference_line(const std::string& line, std::string& path,
+  RefEntry& entry);
+
+
+// meta_from_stat extracts the FileMeta tuple from a stat struct
+FileMeta meta_from_stat(const struct stat& info);
 
 
-ReferenceMap load_reference_data(const std::string& filePath);
+// format_meta returns the metadata portion of a phantom output line
+std::string format_meta(const FileMeta& meta);
 
 
 #endif
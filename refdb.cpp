@@ -0,0 +1,679 @@
+// this file implements phantom's binary reference database
+//
+// (C) Markus Dittrich, 2015
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+#include "digest.hpp"
+#include "hash.hpp"
+#include "refdb.hpp"
+#include "util.hpp"
+
+
+static const char dbMagic[8] = {'P', 'H', 'N', 'T', 'M', 'D', 'B', '\0'};
+static const uint32_t dbVersion = 1;
+
+static size_t align8(size_t n);
+static void put_varint(std::string& out, uint64_t v);
+static const char* get_varint(const char* p, const char* end, uint64_t& v);
+static int hex_value(char c);
+
+
+RefDb::~RefDb() {
+  release();
+}
+
+
+RefDb::RefDb(RefDb&& db) {
+  *this = std::move(db);
+}
+
+
+RefDb& RefDb::operator=(RefDb&& db) {
+  if (this == &db) {
+    return *this;
+  }
+  release();
+  base_ = db.base_;
+  size_ = db.size_;
+  mapped_ = db.mapped_;
+  image_ = std::move(db.image_);
+  header_ = db.header_;
+  entries_ = db.entries_;
+  paths_ = db.paths_;
+  pathsEnd_ = db.pathsEnd_;
+  digests_ = db.digests_;
+  methods_ = std::move(db.methods_);
+
+  db.base_ = nullptr;
+  db.size_ = 0;
+  db.mapped_ = false;
+  db.header_ = nullptr;
+  db.entries_ = nullptr;
+  db.paths_ = nullptr;
+  db.pathsEnd_ = nullptr;
+  db.digests_ = nullptr;
+  return *this;
+}
+
+
+// map maps the database file at path open as fd
+RefDb RefDb::map(int fd, const std::string& path) {
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    throw FailedFileAccess(path);
+  }
+  if (info.st_size < static_cast<off_t>(sizeof(DbHeader))) {
+    throw std::runtime_error("invalid reference database " + path);
+  }
+  void* base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    throw FailedFileAccess(path);
+  }
+
+  RefDb db;
+  db.base_ = static_cast<const char*>(base);
+  db.size_ = info.st_size;
+  db.mapped_ = true;
+  db.attach(db.base_, db.size_);
+  return db;
+}
+
+
+// read reads the database at path from the stream in into memory
+RefDb RefDb::read(std::streambuf& in, const std::string& path) {
+  RefDb db;
+  const size_t chunk = 1 << 16;
+  size_t size = 0;
+  while (true) {
+    db.image_.resize(size + chunk);
+    auto n = in.sgetn(db.image_.data() + size, chunk);
+    size += n;
+    if (n < static_cast<std::streamsize>(chunk)) {
+      break;
+    }
+  }
+  db.image_.resize(size);
+  if (size < sizeof(DbHeader)) {
+    throw std::runtime_error("invalid reference database " + path);
+  }
+  db.base_ = db.image_.data();
+  db.size_ = size;
+  db.attach(db.base_, db.size_);
+  return db;
+}
+
+
+size_t RefDb::size() const {
+  return header_ ? header_->numEntries : 0;
+}
+
+
+bool RefDb::empty() const {
+  return size() == 0;
+}
+
+
+// find returns the index of path or npos if it is not in the database. The
+// full paths at the restart points are compared in place.
+size_t RefDb::find(const std::string& path) const {
+  size_t n = size();
+  if (n == 0) {
+    return npos;
+  }
+
+  size_t lo = 0;
+  size_t hi = (n + restartInterval - 1) / restartInterval;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    uint64_t shared, len;
+    const char* p = paths_ + entries_[mid * restartInterval].pathOffset;
+    p = get_varint(get_varint(p, pathsEnd_, shared), pathsEnd_, len);
+    if (path.compare(0, std::string::npos, p, len) >= 0) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  std::string key;
+  size_t end = std::min<size_t>(n, (lo + 1) * restartInterval);
+  for (size_t i = lo * restartInterval; i < end; ++i) {
+    decode_path(paths_ + entries_[i].pathOffset, key);
+    int c = key.compare(path);
+    if (c == 0) {
+      return i;
+    } else if (c > 0) {
+      break;
+    }
+  }
+  return npos;
+}
+
+
+// path returns the path of entry i by expanding the prefix compressed paths
+// from the preceding restart point
+std::string RefDb::path(size_t i) const {
+  std::string path;
+  for (size_t k = i - i % restartInterval; k <= i; ++k) {
+    decode_path(paths_ + entries_[k].pathOffset, path);
+  }
+  return path;
+}
+
+
+// method returns the (joined) digest names of entry i
+const std::string& RefDb::method(size_t i) const {
+  return methods_[entries_[i].methodIndex].name;
+}
+
+
+// hash returns the hex encoded (joined) digests of entry i
+std::string RefDb::hash(size_t i) const {
+  const auto& m = methods_[entries_[i].methodIndex];
+  const unsigned char* d = digests_ + entries_[i].digestOffset;
+  std::vector<std::string> hexes;
+  for (auto len : m.lengths) {
+    hexes.push_back(to_hex(d, len));
+    d += len;
+  }
+  return join_digests(hexes);
+}
+
+
+// hash_equals compares the hex encoded (joined) digests hash against the
+// raw digests of entry i without decoding them
+bool RefDb::hash_equals(size_t i, const std::string& hash) const {
+  const auto& m = methods_[entries_[i].methodIndex];
+  const unsigned char* d = digests_ + entries_[i].digestOffset;
+  size_t pos = 0;
+  for (size_t k = 0; k < m.lengths.size(); ++k) {
+    if (k > 0) {
+      if (pos >= hash.size() || hash[pos] != digestSeparator) {
+        return false;
+      }
+      ++pos;
+    }
+    size_t len = m.lengths[k];
+    if (pos + 2*len > hash.size()) {
+      return false;
+    }
+    for (size_t b = 0; b < len; ++b) {
+      int hi = hex_value(hash[pos + 2*b]);
+      int lo = hex_value(hash[pos + 2*b + 1]);
+      if (hi < 0 || lo < 0 || (hi << 4 | lo) != d[b]) {
+        return false;
+      }
+    }
+    d += len;
+    pos += 2*len;
+  }
+  return pos == hash.size();
+}
+
+
+bool RefDb::has_meta(size_t i) const {
+  return entries_[i].hasMeta != 0;
+}
+
+
+FileMeta RefDb::meta(size_t i) const {
+  const auto& e = entries_[i];
+  FileMeta meta;
+  meta.size = e.size;
+  meta.mtime = e.mtime;
+  meta.ctime = e.ctime;
+  meta.ino = e.ino;
+  meta.dev = e.dev;
+  return meta;
+}
+
+
+// for_each calls fn with the index and path of every entry in path order
+void RefDb::for_each(const std::function<void(size_t, const std::string&)>& fn) const {
+  std::string path;
+  for (size_t i = 0; i < size(); ++i) {
+    decode_path(paths_ + entries_[i].pathOffset, path);
+    fn(i, path);
+  }
+}
+
+
+// write stores the database image at path; exits on failure
+void RefDb::write(const std::string& path) const {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out || !out.write(base_, size_)) {
+    error("failed to write reference database " + path);
+  }
+}
+
+
+// attach validates the database image at base and sets up the table
+// pointers. Besides the header every entry is checked against the tables
+// it points into so lookups never have to bounds check. Throws
+// std::runtime_error for invalid images.
+void RefDb::attach(const char* base, size_t size) {
+  auto header = reinterpret_cast<const DbHeader*>(base);
+  if (size < sizeof(DbHeader)
+      || memcmp(header->magic, dbMagic, sizeof(dbMagic)) != 0
+      || header->version != dbVersion
+      || header->restartInterval != restartInterval
+      || header->fileSize != size
+      || header->methodsOffset < sizeof(DbHeader)
+      || header->entriesOffset < header->methodsOffset
+      || header->entriesOffset % 8 != 0
+      || header->pathsOffset < header->entriesOffset
+      || (header->pathsOffset - header->entriesOffset) / sizeof(DbEntry) < header->numEntries
+      || header->digestsOffset < header->pathsOffset
+      || header->digestsOffset > size) {
+    throw std::runtime_error("invalid reference database");
+  }
+
+  std::vector<Method> methods;
+  const char* p = base + header->methodsOffset;
+  const char* end = base + header->entriesOffset;
+  for (uint64_t i = 0; i < header->numMethods; ++i) {
+    uint32_t nameLen, numDigests;
+    if (end - p < 8) {
+      throw std::runtime_error("invalid reference database");
+    }
+    memcpy(&nameLen, p, 4);
+    memcpy(&numDigests, p + 4, 4);
+    p += 8;
+    if (static_cast<uint64_t>(end - p) < nameLen + 4ULL*numDigests) {
+      throw std::runtime_error("invalid reference database");
+    }
+    Method m;
+    m.name.assign(p, nameLen);
+    p += nameLen;
+    m.lengths.resize(numDigests);
+    std::copy_n(p, 4*numDigests, reinterpret_cast<char*>(m.lengths.data()));
+    p += 4*numDigests;
+    m.total = std::accumulate(m.lengths.begin(), m.lengths.end(), size_t(0));
+    methods.push_back(std::move(m));
+  }
+
+  auto entries = reinterpret_cast<const DbEntry*>(base + header->entriesOffset);
+  const char* paths = base + header->pathsOffset;
+  const char* pathsEnd = base + header->digestsOffset;
+  uint64_t digestsSize = size - header->digestsOffset;
+  uint64_t prevLen = 0;
+  for (uint64_t i = 0; i < header->numEntries; ++i) {
+    const auto& e = entries[i];
+    if (e.methodIndex >= methods.size()
+        || e.digestOffset > digestsSize
+        || methods[e.methodIndex].total > digestsSize - e.digestOffset
+        || e.pathOffset >= static_cast<uint64_t>(pathsEnd - paths)) {
+      throw std::runtime_error("invalid reference database");
+    }
+    uint64_t shared, len;
+    const char* q = get_varint(paths + e.pathOffset, pathsEnd, shared);
+    q = q ? get_varint(q, pathsEnd, len) : nullptr;
+    if (!q || len > static_cast<uint64_t>(pathsEnd - q)
+        || (i % restartInterval == 0 ? shared != 0 : shared > prevLen)) {
+      throw std::runtime_error("invalid reference database");
+    }
+    prevLen = shared + len;
+  }
+
+  header_ = header;
+  entries_ = reinterpret_cast<const DbEntry*>(base + header->entriesOffset);
+  paths_ = base + header->pathsOffset;
+  pathsEnd_ = base + header->digestsOffset;
+  digests_ = reinterpret_cast<const unsigned char*>(base + header->digestsOffset);
+  methods_ = std::move(methods);
+}
+
+
+// release unmaps or frees the database image
+void RefDb::release() {
+  if (mapped_ && base_) {
+    munmap(const_cast<char*>(base_), size_);
+  }
+  image_.clear();
+  base_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+  header_ = nullptr;
+  entries_ = nullptr;
+  paths_ = nullptr;
+  pathsEnd_ = nullptr;
+  digests_ = nullptr;
+  methods_.clear();
+}
+
+
+// decode_path expands the prefix compressed path record at p. path has to
+// hold the previous path in the same restart block unless p is a restart
+// point.
+const char* RefDb::decode_path(const char* p, std::string& path) const {
+  uint64_t shared, len;
+  p = get_varint(get_varint(p, pathsEnd_, shared), pathsEnd_, len);
+  path.resize(shared);
+  path.append(p, len);
+  return p + len;
+}
+
+
+// add adds the entry for path
+bool RefDbBuilder::add(const std::string& path, const RefEntry& entry) {
+  auto hexes = split_digests(entry.hash);
+  if (split_digests(entry.method).size() != hexes.size()) {
+    return false;
+  }
+
+  Record r;
+  r.path = path;
+  r.hasMeta = entry.hasMeta;
+  r.meta = entry.meta;
+  std::vector<uint32_t> lengths;
+  for (const auto& h : hexes) {
+    if (h.size() % 2 != 0) {
+      return false;
+    }
+    for (size_t i = 0; i < h.size(); i += 2) {
+      int hi = hex_value(h[i]);
+      int lo = hex_value(h[i+1]);
+      if (hi < 0 || lo < 0) {
+        return false;
+      }
+      r.digest.push_back(static_cast<char>(hi << 4 | lo));
+    }
+    lengths.push_back(h.size() / 2);
+  }
+
+  // most entries share their digest names so methods are stored once
+  size_t m = 0;
+  while (m < methods_.size()
+      && (methods_[m].name != entry.method || methods_[m].lengths != lengths)) {
+    ++m;
+  }
+  if (m == methods_.size()) {
+    methods_.push_back({entry.method, lengths, r.digest.size()});
+  }
+  r.methodIndex = m;
+  records_.push_back(std::move(r));
+  return true;
+}
+
+
+size_t RefDbBuilder::size() const {
+  return records_.size();
+}
+
+
+// build returns the in memory database of all added entries
+RefDb RefDbBuilder::build() {
+  std::vector<size_t> order(records_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return records_[a].path < records_[b].path;
+  });
+
+  // drop all but the last of duplicate paths
+  std::vector<size_t> unique;
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (i + 1 < order.size() && records_[order[i]].path == records_[order[i+1]].path) {
+      continue;
+    }
+    unique.push_back(order[i]);
+  }
+
+  std::string methods;
+  for (const auto& m : methods_) {
+    uint32_t nameLen = m.name.size();
+    uint32_t numDigests = m.lengths.size();
+    methods.append(reinterpret_cast<const char*>(&nameLen), 4);
+    methods.append(reinterpret_cast<const char*>(&numDigests), 4);
+    methods.append(m.name);
+    methods.append(reinterpret_cast<const char*>(m.lengths.data()), 4*numDigests);
+  }
+
+  std::vector<DbEntry> entries(unique.size());
+  std::string paths;
+  std::string digests;
+  const std::string* prev = nullptr;
+  for (size_t i = 0; i < unique.size(); ++i) {
+    const auto& r = records_[unique[i]];
+    size_t shared = 0;
+    if (i % restartInterval != 0) {
+      auto limit = std::min(prev->size(), r.path.size());
+      while (shared < limit && (*prev)[shared] == r.path[shared]) {
+        ++shared;
+      }
+    }
+    auto& e = entries[i];
+    e.pathOffset = paths.size();
+    put_varint(paths, shared);
+    put_varint(paths, r.path.size() - shared);
+    paths.append(r.path, shared, std::string::npos);
+    e.digestOffset = digests.size();
+    digests.append(r.digest);
+    e.methodIndex = r.methodIndex;
+    e.hasMeta = r.hasMeta;
+    e.size = r.meta.size;
+    e.mtime = r.meta.mtime;
+    e.ctime = r.meta.ctime;
+    e.ino = r.meta.ino;
+    e.dev = r.meta.dev;
+    prev = &r.path;
+  }
+
+  DbHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, dbMagic, sizeof(dbMagic));
+  header.version = dbVersion;
+  header.restartInterval = restartInterval;
+  header.numEntries = entries.size();
+  header.numMethods = methods_.size();
+  header.methodsOffset = sizeof(DbHeader);
+  header.entriesOffset = align8(header.methodsOffset + methods.size());
+  header.pathsOffset = header.entriesOffset + entries.size() * sizeof(DbEntry);
+  header.digestsOffset = header.pathsOffset + paths.size();
+  header.fileSize = header.digestsOffset + digests.size();
+
+  RefDb db;
+  db.image_.resize(header.fileSize, 0);
+  char* base = db.image_.data();
+  memcpy(base, &header, sizeof(header));
+  // the tables of an empty database are empty and may not have storage so
+  // they are copied with std::copy_n rather than memcpy
+  std::copy_n(methods.data(), methods.size(), base + header.methodsOffset);
+  std::copy_n(reinterpret_cast<const char*>(entries.data()),
+    entries.size() * sizeof(DbEntry), base + header.entriesOffset);
+  std::copy_n(paths.data(), paths.size(), base + header.pathsOffset);
+  std::copy_n(digests.data(), digests.size(), base + header.digestsOffset);
+  db.base_ = base;
+  db.size_ = header.fileSize;
+  db.attach(db.base_, db.size_);
+
+  records_.clear();
+  methods_.clear();
+  return db;
+}
+
+
+// FdStreamBuf is a read only stream buffer on a file descriptor which can
+// look ahead without consuming data
+class FdStreamBuf : public std::streambuf {
+
+public:
+
+  explicit FdStreamBuf(int fd) : fd_(fd) {
+    setg(buf_, buf_, buf_);
+  }
+
+  // peek returns the next n bytes without consuming them or nullptr if the
+  // stream ends before
+  const char* peek(size_t n) {
+    size_t have = egptr() - gptr();
+    memmove(buf_, gptr(), have);
+    while (have < n) {
+      ssize_t r = ::read(fd_, buf_ + have, sizeof(buf_) - have);
+      if (r < 0 && errno == EINTR) {
+        continue;
+      } else if (r <= 0) {
+        break;
+      }
+      have += r;
+    }
+    setg(buf_, buf_, buf_ + have);
+    return have >= n ? buf_ : nullptr;
+  }
+
+protected:
+
+  int_type underflow() override {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    ssize_t r;
+    do {
+      r = ::read(fd_, buf_, sizeof(buf_));
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0) {
+      return traits_type::eof();
+    }
+    setg(buf_, buf_, buf_ + r);
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+
+  int fd_;
+  char buf_[1 << 16];
+};
+
+
+// RefInput opens the reference at filePath and sniffs its format
+RefInput::RefInput(const std::string& filePath)
+  : path_(filePath), fd_(filePath, O_RDONLY),
+    buf_(new FdStreamBuf(fd_.get())), text_(buf_.get()) {
+
+  struct stat info;
+  if (fstat(fd_.get(), &info) < 0) {
+    throw FailedFileAccess(filePath);
+  }
+  regular_ = S_ISREG(info.st_mode);
+  const char* magic = buf_->peek(sizeof(dbMagic));
+  binary_ = magic != nullptr && memcmp(magic, dbMagic, sizeof(dbMagic)) == 0;
+}
+
+
+RefInput::~RefInput() = default;
+
+
+// load returns the binary database
+RefDb RefInput::load() {
+  if (regular_) {
+    return RefDb::map(fd_.get(), path_);
+  }
+  return RefDb::read(*buf_, path_);
+}
+
+
+// RefReader reads the entries of a text or binary reference file one after
+// the other in file order
+RefReader::RefReader(const std::string& filePath) : input_(filePath) {
+  binary_ = input_.binary();
+  if (binary_) {
+    db_ = input_.load();
+    if (db_.mapped_) {
+      madvise(const_cast<char*>(db_.base_), db_.size_, MADV_SEQUENTIAL);
+    }
+  }
+}
+
+
+// next reads the next entry; returns false at the end
+bool RefReader::next(std::string& path, RefEntry& entry) {
+  if (binary_) {
+    if (index_ == db_.size()) {
+      return false;
+    }
+    db_.decode_path(db_.paths_ + db_.entries_[index_].pathOffset, path_);
+    path = path_;
+    entry.method = db_.method(index_);
+    entry.hash = db_.hash(index_);
+    entry.hasMeta = db_.has_meta(index_);
+    entry.meta = db_.meta(index_);
+    ++index_;
+    return true;
+  }
+
+  std::string line;
+  if (!getline(input_.text(), line)) {
+    return false;
+  }
+  if (!parse_reference_line(line, path, entry)) {
+    throw std::runtime_error("malformed reference line: " + line);
+  }
+  return true;
+}
+
+
+// write_text prints the content of db in phantom's text format to os
+void write_text(const RefDb& db, std::ostream& os) {
+  db.for_each([&](size_t i, const std::string& path) {
+    os << db.method(i) << " , " << path << " , " << db.hash(i);
+    if (db.has_meta(i)) {
+      os << " , " << format_meta(db.meta(i));
+    }
+    os << "\n";
+  });
+}
+
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~size_t(7);
+}
+
+
+// put_varint appends v to out as LEB128 varint
+static void put_varint(std::string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+
+// get_varint decodes the LEB128 varint at p into v. Returns nullptr if the
+// varint runs past end or is longer than 64 bits.
+static const char* get_varint(const char* p, const char* end, uint64_t& v) {
+  v = 0;
+  int shift = 0;
+  unsigned char c;
+  do {
+    if (p == end || shift > 63) {
+      return nullptr;
+    }
+    c = static_cast<unsigned char>(*p++);
+    v |= static_cast<uint64_t>(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return p;
+}
+
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
@@ -0,0 +1,248 @@
+// this file implements phantom's binary reference database. The database
+// stores the same information as the text output format, but is laid out
+// for fast loading and zero-copy lookups after being mmapped:
+//
+//   header    magic, version and offsets of the tables below
+//   methods   table of distinct digest names with their raw digest lengths
+//   entries   fixed size records (metadata, digest and path offsets) sorted
+//             by path
+//   paths     prefix compressed paths: <shared len> <suffix len> <suffix>
+//             (varints); every restartInterval-th path is stored in full
+//   digests   raw binary digests
+//
+// Lookups binary search the full paths at the restart points and then scan
+// at most restartInterval prefix compressed paths.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef REFDB_HPP
+#define REFDB_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "refParser.hpp"
+#include "util.hpp"
+
+
+// every restartInterval-th path is stored without prefix compression
+const uint32_t restartInterval = 16;
+
+
+// DbHeader is the on-disk header of a binary reference database
+struct DbHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t restartInterval;
+  uint64_t numEntries;
+  uint64_t numMethods;
+  uint64_t methodsOffset;
+  uint64_t entriesOffset;
+  uint64_t pathsOffset;
+  uint64_t digestsOffset;
+  uint64_t fileSize;
+};
+
+
+// DbEntry is the on-disk record of a single file
+struct DbEntry {
+  uint64_t pathOffset;    // relative to the path table
+  uint64_t digestOffset;  // relative to the digest table
+  uint32_t methodIndex;
+  uint32_t hasMeta;
+  int64_t size;
+  int64_t mtime;
+  int64_t ctime;
+  uint64_t ino;
+  uint64_t dev;
+};
+
+
+// RefDb is an immutable, sorted table of reference entries. It is either
+// backed by an mmapped database file or by an in memory image created by
+// RefDbBuilder. Entries are addressed by their index in path order.
+class RefDb {
+
+public:
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+  RefDb() = default;
+  ~RefDb();
+
+  RefDb(const RefDb& db) = delete;
+  RefDb& operator=(const RefDb& db) = delete;
+  RefDb(RefDb&& db);
+  RefDb& operator=(RefDb&& db);
+
+  size_t size() const;
+  bool empty() const;
+
+  // valid returns true if the database was opened or built, i.e. also for
+  // a database without entries
+  bool valid() const {
+    return header_ != nullptr;
+  }
+
+  // find returns the index of path or npos if it is not in the database
+  size_t find(const std::string& path) const;
+
+  // path returns the path of entry i
+  std::string path(size_t i) const;
+
+  // method returns the (joined) digest names of entry i
+  const std::string& method(size_t i) const;
+
+  // hash returns the hex encoded (joined) digests of entry i
+  std::string hash(size_t i) const;
+
+  // hash_equals compares the hex encoded (joined) digests hash against the
+  // raw digests of entry i without decoding them
+  bool hash_equals(size_t i, const std::string& hash) const;
+
+  bool has_meta(size_t i) const;
+  FileMeta meta(size_t i) const;
+
+  // for_each calls fn with the index and path of every entry in path order
+  void for_each(const std::function<void(size_t, const std::string&)>& fn) const;
+
+  // write stores the database image at path; exits on failure
+  void write(const std::string& path) const;
+
+private:
+
+  friend class RefDbBuilder;
+  friend class RefInput;
+  friend class RefReader;
+
+  struct Method {
+    std::string name;
+    std::vector<uint32_t> lengths;
+    size_t total;
+  };
+
+  static RefDb map(int fd, const std::string& path);
+  static RefDb read(std::streambuf& in, const std::string& path);
+
+  void attach(const char* base, size_t size);
+  void release();
+  const char* decode_path(const char* p, std::string& path) const;
+
+  const char* base_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::vector<char> image_;
+
+  const DbHeader* header_ = nullptr;
+  const DbEntry* entries_ = nullptr;
+  const char* paths_ = nullptr;
+  const char* pathsEnd_ = nullptr;
+  const unsigned char* digests_ = nullptr;
+  std::vector<Method> methods_;
+};
+
+
+// RefDbBuilder collects reference entries in any order and builds a RefDb
+// from them. If a path is added more than once the last entry wins.
+class RefDbBuilder {
+
+public:
+
+  // add adds the entry for path. Returns false if the digests are not
+  // valid hex or do not match the digest names.
+  bool add(const std::string& path, const RefEntry& entry);
+
+  size_t size() const;
+
+  // build returns the in memory database of all added entries
+  RefDb build();
+
+private:
+
+  struct Record {
+    std::string path;
+    uint32_t methodIndex;
+    std::string digest;     // raw
+    bool hasMeta;
+    FileMeta meta;
+  };
+
+  std::vector<Record> records_;
+  std::vector<RefDb::Method> methods_;
+};
+
+
+class FdStreamBuf;
+
+// RefInput opens a reference file and tells binary databases from text
+// references. The file is opened once and the magic is sniffed from the
+// buffered stream, so pipes and FIFOs (e.g. /dev/stdin) lose no data.
+class RefInput {
+
+public:
+
+  // throws FailedFileAccess if filePath can not be opened
+  explicit RefInput(const std::string& filePath);
+  ~RefInput();
+
+  RefInput(const RefInput& r) = delete;
+  RefInput& operator=(const RefInput& r) = delete;
+
+  bool binary() const {
+    return binary_;
+  }
+
+  // load returns the binary database. Regular files are mapped, others are
+  // read into memory. Throws std::runtime_error if it is not a valid
+  // database.
+  RefDb load();
+
+  // text returns the stream of a text reference
+  std::istream& text() {
+    return text_;
+  }
+
+private:
+
+  std::string path_;
+  Fd fd_;
+  bool regular_ = false;
+  bool binary_ = false;
+  std::unique_ptr<FdStreamBuf> buf_;
+  std::istream text_;
+};
+
+
+// RefReader reads the entries of a text or binary reference file one after
+// the other in file order without loading the whole reference
+class RefReader {
+
+public:
+
+  // throws FailedFileAccess if filePath can not be read and
+  // std::runtime_error if it is an invalid binary database
+  RefReader(const std::string& filePath);
+
+  // next reads the next entry; returns false at the end. Throws
+  // std::runtime_error for malformed lines.
+  bool next(std::string& path, RefEntry& entry);
+
+private:
+
+  bool binary_;
+  RefDb db_;
+  size_t index_ = 0;
+  std::string path_;      // previous path for prefix expansion
+  RefInput input_;
+};
+
+
+// write_text prints the content of db in phantom's text format to os
+void write_text(const RefDb& db, std::ostream& os);
+
+#endif
@@ -0,0 +1,144 @@
+// this file implements an external sorter for key/value records
+//
+// (C) Markus Dittrich, 2015
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#include "runs.hpp"
+#include "util.hpp"
+
+
+static void write_string(FILE* fp, const std::string& s);
+static bool read_string(FILE* fp, std::string& s);
+
+
+RunSorter::RunSorter(const std::string& tmpDir, size_t maxBytes)
+  : tmpDir_(tmpDir), maxBytes_(maxBytes) {}
+
+
+RunSorter::~RunSorter() {
+  for (auto fp : runs_) {
+    fclose(fp);
+  }
+}
+
+
+// add adds a record and spills the in memory records once they exceed the
+// memory limit
+void RunSorter::add(std::string key, std::string value) {
+  bytes_ += key.size() + value.size() + sizeof(Record);
+  buffer_.push_back({std::move(key), std::move(value)});
+  if (bytes_ >= maxBytes_) {
+    spill();
+  }
+}
+
+
+// finish sorts the remaining in memory records and prepares the merge
+void RunSorter::finish() {
+  std::sort(buffer_.begin(), buffer_.end(),
+    [](const Record& a, const Record& b) { return a.key < b.key; });
+  bufferPos_ = 0;
+  for (size_t s = 0; s <= runs_.size(); ++s) {
+    if (s < runs_.size()) {
+      rewind(runs_[s]);
+    }
+    Head h;
+    h.source = s;
+    if (read(s, h.rec)) {
+      heap_.push(std::move(h));
+    }
+  }
+}
+
+
+// next returns the next record in key order; false if none are left
+bool RunSorter::next(std::string& key, std::string& value) {
+  if (heap_.empty()) {
+    return false;
+  }
+  // priority_queue::top is const, hence the copy
+  Head h = heap_.top();
+  heap_.pop();
+  key = std::move(h.rec.key);
+  value = std::move(h.rec.value);
+  if (read(h.source, h.rec)) {
+    heap_.push(std::move(h));
+  }
+  return true;
+}
+
+
+// num_runs returns the number of runs spilled to disk
+size_t RunSorter::num_runs() const {
+  return runs_.size();
+}
+
+
+// spill writes the sorted in memory records to a new run file
+void RunSorter::spill() {
+  std::string dir = tmpDir_;
+  std::string path = concat_filepaths(dir, "phantom-run-XXXXXX");
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    error("failed to create sort run in " + tmpDir_);
+  }
+  unlink(path.c_str());
+  FILE* fp = fdopen(fd, "w+");
+  if (fp == NULL) {
+    close(fd);
+    error("failed to open sort run in " + tmpDir_);
+  }
+
+  std::sort(buffer_.begin(), buffer_.end(),
+    [](const Record& a, const Record& b) { return a.key < b.key; });
+  for (const auto& r : buffer_) {
+    write_string(fp, r.key);
+    write_string(fp, r.value);
+  }
+  if (fflush(fp) != 0 || ferror(fp)) {
+    fclose(fp);
+    error("failed to write sort run to " + tmpDir_);
+  }
+  runs_.push_back(fp);
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+  bytes_ = 0;
+}
+
+
+// read reads the next record of source into rec
+bool RunSorter::read(size_t source, Record& rec) {
+  if (source == runs_.size()) {
+    if (bufferPos_ == buffer_.size()) {
+      return false;
+    }
+    rec = std::move(buffer_[bufferPos_++]);
+    return true;
+  }
+  return read_string(runs_[source], rec.key)
+    && read_string(runs_[source], rec.value);
+}
+
+
+// write_string writes s to fp prefixed by its length
+static void write_string(FILE* fp, const std::string& s) {
+  uint64_t size = s.size();
+  fwrite(&size, sizeof(size), 1, fp);
+  fwrite(s.data(), 1, s.size(), fp);
+}
+
+
+// read_string reads a length prefixed string from fp
+static bool read_string(FILE* fp, std::string& s) {
+  uint64_t size;
+  if (fread(&size, sizeof(size), 1, fp) != 1) {
+    return false;
+  }
+  s.resize(size);
+  return size == 0 || fread(&s[0], 1, size, fp) == size;
+}
@@ -0,0 +1,76 @@
+// this file implements an external sorter for key/value records. Records are
+// collected in memory and spilled to disk as sorted runs once the memory
+// limit is reached. The runs are then merged back into a single stream
+// sorted by key. Run files are unlinked right after creation so they
+// disappear with the process.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef RUNS_HPP
+#define RUNS_HPP
+
+#include <cstdio>
+
+#include <queue>
+#include <string>
+#include <vector>
+
+
+// default amount of record data kept in memory before a run is spilled
+const size_t defaultRunSize = 64*1024*1024;
+
+
+// RunSorter sorts an arbitrary number of key/value records in bounded memory
+class RunSorter {
+
+public:
+
+  RunSorter(const std::string& tmpDir, size_t maxBytes = defaultRunSize);
+  ~RunSorter();
+
+  RunSorter(const RunSorter& r) = delete;
+  RunSorter& operator=(const RunSorter& r) = delete;
+
+  // add adds a record; must not be called after finish()
+  void add(std::string key, std::string value);
+
+  // finish sorts the remaining in memory records and prepares the merge
+  void finish();
+
+  // next returns the next record in key order; false if none are left
+  bool next(std::string& key, std::string& value);
+
+  // num_runs returns the number of runs spilled to disk
+  size_t num_runs() const;
+
+private:
+
+  struct Record {
+    std::string key;
+    std::string value;
+  };
+
+  struct Head {
+    Record rec;
+    size_t source;
+
+    bool operator>(const Head& h) const {
+      return rec.key > h.rec.key;
+    }
+  };
+
+  void spill();
+  bool read(size_t source, Record& rec);
+
+  std::string tmpDir_;
+  size_t maxBytes_;
+  size_t bytes_ = 0;
+  std::vector<Record> buffer_;
+  std::vector<FILE*> runs_;
+
+  // merge state; the in memory records act as source runs_.size()
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap_;
+  size_t bufferPos_ = 0;
+};
+
+#endif
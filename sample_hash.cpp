@@ -0,0 +1,103 @@
+// this file implements sampled quick-check digests
+//
+// (C) Markus Dittrich, 2015
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "sample_hash.hpp"
+#include "trace.hpp"
+#include "tree_hash.hpp"
+
+
+// parse_sample_digest returns true if name is a valid sampled digest name
+// and fills in spec accordingly
+bool parse_sample_digest(const std::string& name, SampleSpec& spec) {
+  const std::string prefix = "sample-";
+  if (name.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  auto md = name.substr(prefix.size());
+  int samples = defaultSampleCount;
+  auto slash = md.find('/');
+  if (slash != std::string::npos) {
+    auto n = md.substr(slash + 1);
+    if (n.empty() || n.size() > 6
+      || n.find_first_not_of("0123456789") != std::string::npos) {
+      return false;
+    }
+    samples = std::stoi(n);
+    if (samples < 2) {
+      return false;
+    }
+    md = md.substr(0, slash);
+  }
+  TreeSpec tree;
+  if (md.compare(0, prefix.size(), prefix) == 0 || parse_tree_digest(md, tree)
+    || !is_digest(md)) {
+    return false;
+  }
+
+  spec.md = md;
+  spec.samples = samples;
+  return true;
+}
+
+
+// read_block reads size bytes at offset off of fd into buf and feeds them
+// to digest
+static void read_block(int fd, const FileEntry& file, off_t off, size_t size,
+  Digest& digest, std::vector<char>& buf) {
+
+  size_t total = 0;
+  while (total < size) {
+    ssize_t n;
+    {
+      TraceScope ts(TraceStage::read);
+      n = pread(fd, buf.data() + total, size - total, off + total);
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      throw FailedFileAccess(file.path());
+    }
+    total += n;
+  }
+  TraceScope ts(TraceStage::digest);
+  digest.update(buf.data(), size);
+}
+
+
+// sample_hash computes the sampled digest of file
+std::string sample_hash(const SampleSpec& spec, Digest& digest,
+  const FileEntry& file, off_t size, std::vector<char>& buf) {
+
+  Fd fd(file, O_RDONLY | O_NOATIME);
+  digest.reset();
+  unsigned char sizeBytes[8];
+  for (int i = 0; i < 8; ++i) {
+    sizeBytes[i] = static_cast<unsigned char>(
+      static_cast<unsigned long long>(size) >> 8*i);
+  }
+  digest.update(reinterpret_cast<const char*>(sizeBytes), sizeof(sizeBytes));
+
+  buf.resize(sampleBlockSize);
+  off_t sampled = static_cast<off_t>(spec.samples) * sampleBlockSize;
+  if (size <= sampled) {
+    for (off_t off = 0; off < size; off += sampleBlockSize) {
+      read_block(fd.get(), file, off,
+        std::min<off_t>(sampleBlockSize, size - off), digest, buf);
+    }
+  } else {
+    off_t span = size - sampleBlockSize;
+    for (int i = 0; i < spec.samples; ++i) {
+      off_t off = span / (spec.samples - 1) * i
+        + span % (spec.samples - 1) * i / (spec.samples - 1);
+      read_block(fd.get(), file, off, sampleBlockSize, digest, buf);
+    }
+  }
+  return digest.final();
+}
@@ -0,0 +1,55 @@
+// this file implements sampled quick-check digests. Instead of every byte
+// only the file size and a fixed number of blocks at deterministic offsets
+// are hashed:
+//
+//   H(size as 8 byte little endian || block_0 || ... || block_n-1)
+//
+// where block i starts at i * (size - blockSize) / (n - 1), i.e. the first
+// block is the head and the last block the tail of the file with the others
+// spread evenly in between. Files of up to n blocks are hashed in full
+// (after the size). A differing sampled digest means the file changed; an
+// identical one only means it likely did not.
+// Sampled digests are named sample-<md> (using the default number of
+// samples) or sample-<md>/<samples>, e.g. sample-md5 or sample-blake3/64.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef SAMPLE_HASH_HPP
+#define SAMPLE_HASH_HPP
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "digest.hpp"
+#include "util.hpp"
+
+
+// default number of sampled blocks per file
+const int defaultSampleCount = 16;
+
+// size of a sampled block in bytes
+const size_t sampleBlockSize = 4096;
+
+
+// SampleSpec describes the parameters of a sampled digest
+struct SampleSpec {
+  std::string md;        // name of the underlying digest
+  int samples = defaultSampleCount;
+};
+
+
+// parse_sample_digest returns true if name is a valid sampled digest name
+// and fills in spec accordingly
+bool parse_sample_digest(const std::string& name, SampleSpec& spec);
+
+
+// sample_hash computes the sampled digest of file which is expected to be
+// size bytes long using digest (of type spec.md) and buf as read buffer.
+// Throws FailedFileAccess if the file can not be read or is shorter than
+// size.
+std::string sample_hash(const SampleSpec& spec, Digest& digest,
+  const FileEntry& file, off_t size, std::vector<char>& buf);
+
+#endif
@@ -0,0 +1,153 @@
+// this file implements sharded scans and the merging of shard manifests
+//
+// (C) Markus Dittrich 2015
+
+#include <cstring>
+#include <stdexcept>
+
+#include "cmdline.hpp"
+#include "hash.hpp"
+#include "output.hpp"
+#include "refdb.hpp"
+#include "runs.hpp"
+#include "shard.hpp"
+#include "util.hpp"
+#include "worker.hpp"
+
+
+// set_root records the root path. Trailing '/'s are dropped as they are
+// for the directory paths handed out by the walkers.
+void Shard::set_root(const std::string& rootPath) {
+  size_t end = rootPath.find_last_not_of("/");
+  rootLen = end == std::string::npos ? 0 : end + 1;
+}
+
+
+// depth_of returns the depth of the directory at dirPath below the root
+int Shard::depth_of(const std::string& dirPath) const {
+  int d = 0;
+  for (size_t i = rootLen; i < dirPath.size(); ++i) {
+    d += dirPath[i] == '/';
+  }
+  return d;
+}
+
+
+// owns hashes the path relative to the root with 64 bit FNV-1a which is
+// stable across hosts and phantom builds
+bool Shard::owns(const std::string& path) const {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = rootLen; i < path.size(); ++i) {
+    h ^= static_cast<unsigned char>(path[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h % count == index;
+}
+
+
+// parse_shard parses a shard specification of the form i/N
+bool parse_shard(const std::string& spec, Shard& shard) {
+  auto pos = spec.find('/');
+  if (pos == std::string::npos) {
+    return false;
+  }
+  char* end;
+  long i = strtol(spec.c_str(), &end, 10);
+  if (end != spec.c_str() + pos) {
+    return false;
+  }
+  long n = strtol(spec.c_str() + pos + 1, &end, 10);
+  if (*end != '\0' || pos + 1 == spec.size() || n < 1 || i < 0 || i >= n) {
+    return false;
+  }
+  shard.index = i;
+  shard.count = n;
+  return true;
+}
+
+
+// merge_manifests sorts the entries of all manifests with an external sort
+// so manifests of any size can be merged in bounded memory. All manifests
+// have to be hashed with the same digests.
+void merge_manifests(CmdLineOpts& opts) {
+
+  RunSorter sorter(opts.tmpDir);
+  std::string method;
+  try {
+    for (const auto& manifest : opts.mergePaths) {
+      RefReader reader(manifest);
+      std::string path;
+      RefEntry entry;
+      while (reader.next(path, entry)) {
+        if (!entry.hasMeta) {
+          error("manifest " + manifest + " lacks file metadata");
+        }
+        if (method.empty()) {
+          method = entry.method;
+        } else if (entry.method != method) {
+          error("manifests were hashed with different digests (" + method
+            + " and " + entry.method + ")");
+        }
+        std::string value(reinterpret_cast<const char*>(&entry.meta),
+          sizeof(entry.meta));
+        value.append(entry.hash);
+        sorter.add(std::move(path), std::move(value));
+      }
+    }
+  } catch (std::runtime_error& e) {
+    error(e.what());
+  }
+  sorter.finish();
+
+  // shards never overlap so a path showing up twice means the manifests
+  // are not from the same sharded scan
+  std::string prevPath;
+  auto next = [&](std::string& path, std::string& value) {
+    if (!sorter.next(path, value)) {
+      return false;
+    }
+    if (path == prevPath) {
+      error("path " + path + " is contained in several manifests");
+    }
+    prevPath = path;
+    return true;
+  };
+
+  std::string path;
+  std::string value;
+  if (opts.compareToRef) {
+    if (!method.empty()) {
+      opts.digests = split_digests(method);
+      opts.hashMethod = method;
+    }
+    OutputBuffer out(false, opts.tmpDir);
+    compare_sorted(next, out, opts);
+    out.finish();
+  } else if (!opts.outputDbPath.empty()) {
+    RefDbBuilder builder;
+    RefEntry entry;
+    entry.method = method;
+    entry.hasMeta = true;
+    while (next(path, value)) {
+      memcpy(&entry.meta, value.data(), sizeof(entry.meta));
+      entry.hash = value.substr(sizeof(entry.meta));
+      if (!builder.add(path, entry)) {
+        error("invalid digest for " + path);
+      }
+    }
+    builder.build().write(opts.outputDbPath);
+  } else {
+    OutputBuffer out(false, opts.tmpDir);
+    std::string line;
+    FileMeta meta;
+    while (next(path, value)) {
+      memcpy(&meta, value.data(), sizeof(meta));
+      line.clear();
+      line.append(method).append(" , ").append(path).append(" , ")
+        .append(value, sizeof(meta), std::string::npos).append(" , ");
+      append_meta(line, meta);
+      out.add_line(path, line);
+    }
+    out.finish();
+  }
+}
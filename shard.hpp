@@ -0,0 +1,61 @@
+// this file implements sharded scans. A tree is partitioned among N phantom
+// processes (possibly on different hosts sharing a filesystem) by hashing
+// the paths of the directories at the shard depth relative to the root.
+// Every shard walks the directories above the shard depth but only hashes
+// the files of those it owns, and only descends into the directories at the
+// shard depth it owns. Since the partition only depends on paths relative
+// to the root, hosts may mount the tree at different locations.
+//
+// The manifests written by the shards are combined with merge_manifests
+// into a single path sorted manifest or a compare report.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include <string>
+#include <vector>
+
+
+// depth below the root at which directories are assigned to shards
+const int defaultShardDepth = 1;
+
+
+// Shard describes the part of the tree handled by this process
+struct Shard {
+  unsigned int index = 0;     // this shard
+  unsigned int count = 1;     // number of shards
+  int depth = defaultShardDepth;
+  size_t rootLen = 0;         // length of the root path (see set_root)
+
+  bool enabled() const {
+    return count > 1;
+  }
+
+  // set_root records the root path relative to which paths are hashed
+  void set_root(const std::string& rootPath);
+
+  // depth_of returns the depth of the directory at dirPath below the root
+  int depth_of(const std::string& dirPath) const;
+
+  // owns returns true if this shard owns the directory (or file) at path
+  bool owns(const std::string& path) const;
+};
+
+
+// parse_shard parses a shard specification of the form i/N with 0 <= i < N
+// into shard. Returns false if spec is invalid.
+bool parse_shard(const std::string& spec, Shard& shard);
+
+
+struct CmdLineOpts;
+
+// merge_manifests combines the (text or binary) manifests given in
+// opts.mergePaths. The merged results are printed sorted by path, stored as
+// a binary database (--output_db) or compared against the path sorted
+// reference (--compare). Exits on failure and if a path shows up in
+// several manifests.
+void merge_manifests(CmdLineOpts& opts);
+
+#endif
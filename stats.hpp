@@ -1,5 +1,7 @@
 // Stats keeps track of runtime statistics (number of files parsed,
-// number of bytes read, etc.)
+// number of bytes read, etc.). Counters are sharded per thread and only
+// aggregated on demand so that recording them does not serialize the hash
+// threads.
 //
 // (C) Markus Dittrich 2015
 
@@ -8,9 +10,38 @@
 
 #include <sys/stat.h>
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <map>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+
+
+// ReadStats accumulates the data read and time spent reading and hashing
+// for a single read mode
+struct ReadStats {
+  long long num_bytes = 0;
+  std::chrono::nanoseconds time{0};
+};
+
+using ReadStatsMap = std::map<std::string, ReadStats>;
+
+
+// histograms use power of two buckets; bucket 0 counts zero values and
+// bucket i > 0 values in [2^(i-1), 2^i)
+const int numHistBuckets = 64;
+using Histogram = std::array<long long, numHistBuckets>;
+
+
+// hist_bucket returns the histogram bucket of v
+inline int hist_bucket(unsigned long long v) {
+  return v == 0 ? 0 : 64 - __builtin_clzll(v);
+}
 
 
 class Stats {
@@ -22,37 +53,169 @@ public:
 
 
   long long num_files() const {
-    std::lock_guard<std::mutex> lg(mx_);
-    return num_files_;
+    return sum(&Shard::num_files);
   }
 
 
   long long num_bytes() const {
-    std::lock_guard<std::mutex> lg(mx_);
-    return num_bytes_;
+    return sum(&Shard::num_bytes);
+  }
+
+
+  long long num_trusted() const {
+    return sum(&Shard::num_trusted);
+  }
+
+
+  long long num_linked() const {
+    return sum(&Shard::num_linked);
+  }
+
+
+  long long linked_bytes() const {
+    return sum(&Shard::linked_bytes);
+  }
+
+
+  long long num_resumed() const {
+    return sum(&Shard::num_resumed);
+  }
+
+
+  // add_trusted accounts for a file which was not rehashed since its
+  // metadata matched the reference
+  void add_trusted() {
+    shard().num_trusted.fetch_add(1, std::memory_order_relaxed);
+  }
+
+
+  // add_linked accounts for a hard link whose hash was taken from another
+  // path of the same inode so its size bytes did not have to be read
+  void add_linked(off_t size) {
+    auto& s = shard();
+    s.num_linked.fetch_add(1, std::memory_order_relaxed);
+    s.linked_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+
+
+  // add_resumed accounts for a file whose hash was taken from the
+  // checkpoint journal of a previous run
+  void add_resumed() {
+    shard().num_resumed.fetch_add(1, std::memory_order_relaxed);
   }
 
 
   void add(off_t size) {
+    auto& s = shard();
+    s.num_files.fetch_add(1, std::memory_order_relaxed);
+    s.num_bytes.fetch_add(size, std::memory_order_relaxed);
+    s.size_hist[hist_bucket(size)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // add_read accounts for size bytes which were read and hashed in mode
+  // taking dur time
+  void add_read(const std::string& mode, off_t size,
+    std::chrono::nanoseconds dur) {
+    auto& s = shard();
+    s.latency_hist[hist_bucket(dur.count())].fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lg(s.mx);
+    auto& rs = s.readStats[mode];
+    rs.num_bytes += size;
+    rs.time += dur;
+  }
+
+  ReadStatsMap read_stats() const {
+    ReadStatsMap total;
+    for (const auto& s : shards_) {
+      std::lock_guard<std::mutex> lg(s.mx);
+      for (const auto& r : s.readStats) {
+        total[r.first].num_bytes += r.second.num_bytes;
+        total[r.first].time += r.second.time;
+      }
+    }
+    return total;
+  }
+
+  // size_histogram returns the histogram of file sizes in bytes
+  Histogram size_histogram() const {
+    return hist(&Shard::size_hist);
+  }
+
+  // latency_histogram returns the histogram of per file read and hash
+  // times in ns
+  Histogram latency_histogram() const {
+    return hist(&Shard::latency_hist);
+  }
+
+  // add_queue_stats records the final statistics of a pipeline queue
+  void add_queue_stats(const QueueStats& qs) {
     std::lock_guard<std::mutex> lg(mx_);
-    ++num_files_;
-    num_bytes_ += size;
+    queueStats_.push_back(qs);
   }
 
-  std::chrono::time_point<std::chrono::system_clock> startTime() const {
+  std::vector<QueueStats> queue_stats() const {
     std::lock_guard<std::mutex> lg(mx_);
+    return queueStats_;
+  }
+
+  std::chrono::time_point<std::chrono::system_clock> startTime() const {
     return startTime_;
   }
 
 
 private:
 
-  mutable std::mutex mx_;
+  static const int numShards = 64;
+
+  using HistCounters = std::array<std::atomic<long long>, numHistBuckets>;
+
+  // Shard holds the counters of the threads mapped to it; shards live on
+  // separate cache lines
+  struct alignas(64) Shard {
+    std::atomic<long long> num_files{0};
+    std::atomic<long long> num_bytes{0};
+    std::atomic<long long> num_trusted{0};
+    std::atomic<long long> num_linked{0};
+    std::atomic<long long> linked_bytes{0};
+    std::atomic<long long> num_resumed{0};
+    HistCounters size_hist{};
+    HistCounters latency_hist{};
+    mutable std::mutex mx;   // protects readStats
+    ReadStatsMap readStats;
+  };
+
+  // shard returns the shard of the calling thread. Threads are assigned
+  // shards round robin on first use.
+  Shard& shard() {
+    static std::atomic<unsigned int> nextThread{0};
+    thread_local unsigned int id = nextThread.fetch_add(1);
+    return shards_[id % numShards];
+  }
+
+  long long sum(std::atomic<long long> Shard::*counter) const {
+    long long total = 0;
+    for (const auto& s : shards_) {
+      total += (s.*counter).load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  Histogram hist(HistCounters Shard::*counters) const {
+    Histogram total{};
+    for (const auto& s : shards_) {
+      for (int b = 0; b < numHistBuckets; ++b) {
+        total[b] += (s.*counters)[b].load(std::memory_order_relaxed);
+      }
+    }
+    return total;
+  }
+
+  std::array<Shard, numShards> shards_;
 
-  long long num_files_ = 0;
-  long long num_bytes_ = 0;
+  mutable std::mutex mx_;   // protects queueStats_
+  std::vector<QueueStats> queueStats_;
 
-  std::chrono::time_point<std::chrono::system_clock> startTime_;
+  const std::chrono::time_point<std::chrono::system_clock> startTime_;
 };
 
 #endif
@@ -0,0 +1,124 @@
+#!/bin/bash
+#
+# run_tests.sh runs phantom (by default the sanitizer build made by 'make')
+# on small scratch trees and checks the edge cases of the reference,
+# database and journal handling. Every test prints a line with its name and
+# result; the script exits non-zero if any test failed.
+#
+# usage: run_tests.sh [-p phantom] [-w work dir]
+#
+# (C) Markus Dittrich 2015
+
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+PHANTOM=$TEST_DIR/../phantom
+WORK_DIR=${TMPDIR:-/tmp}/phantom_tests
+
+usage() {
+  echo "usage: run_tests.sh [-p phantom] [-w work dir]" >&2
+  exit 1
+}
+
+while getopts "p:w:h" opt; do
+  case $opt in
+    p) PHANTOM=$OPTARG ;;
+    w) WORK_DIR=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+if [ $# -ne 0 ]; then
+  usage
+fi
+
+if [ ! -x "$PHANTOM" ]; then
+  echo "run_tests.sh: $PHANTOM not found; run 'make' first" >&2
+  exit 1
+fi
+PHANTOM=$(cd "$(dirname "$PHANTOM")" && pwd)/$(basename "$PHANTOM")
+
+rm -rf "$WORK_DIR"
+mkdir -p "$WORK_DIR"
+FAILED=0
+
+# check runs the test function $1 in a fresh directory and reports whether
+# it succeeded. The subshell must not be part of a condition since that
+# would switch off set -e within it.
+check() {
+  local dir=$WORK_DIR/$1
+  mkdir -p "$dir"
+  (set -e; cd "$dir"; "$1") > "$dir/log" 2>&1
+  if [ $? -eq 0 ]; then
+    echo "$1: ok"
+  else
+    echo "$1: FAILED (see $dir/log)"
+    FAILED=1
+  fi
+}
+
+
+# an empty tree gives an empty database which converts to an empty text
+# reference and back
+empty_db_roundtrip() {
+  mkdir tree
+  "$PHANTOM" -o empty.db tree
+  "$PHANTOM" -C empty.db > empty.txt
+  [ ! -s empty.txt ]
+  "$PHANTOM" -C empty.txt -o again.db
+  cmp empty.db again.db
+}
+
+
+# resuming from a journal holding only a partial line (as left by a crash)
+# or only malformed lines rehashes everything
+torn_journal_resume() {
+  mkdir tree
+  echo a > tree/a
+  echo b > tree/b
+  "$PHANTOM" -O tree > expected.txt
+  printf 'garbage' > torn.journal
+  "$PHANTOM" -O -k torn.journal -R tree > torn.txt
+  cmp expected.txt torn.txt
+  printf 'garbage\n' > malformed.journal
+  "$PHANTOM" -O -k malformed.journal -R tree > malformed.txt
+  cmp expected.txt malformed.txt
+  : > empty.journal
+  "$PHANTOM" -O -k empty.journal -R tree > empty.txt
+  cmp expected.txt empty.txt
+}
+
+
+# text and binary references read from pipes are sniffed without losing
+# their first bytes
+piped_reference() {
+  mkdir tree
+  echo a > tree/a
+  echo b > tree/b
+  "$PHANTOM" -O tree > ref.txt
+  "$PHANTOM" -o ref.db tree
+  cat ref.txt | "$PHANTOM" -C /dev/stdin | cmp - ref.txt
+  cat ref.db | "$PHANTOM" -C /dev/stdin | cmp - ref.txt
+  cat ref.txt | "$PHANTOM" -c /dev/stdin tree > report.txt
+  [ ! -s report.txt ]
+  cat ref.db | "$PHANTOM" -S -c /dev/stdin tree > report.txt
+  [ ! -s report.txt ]
+  cat ref.txt | "$PHANTOM" -M /dev/stdin | cmp - ref.txt
+}
+
+
+# reference lines with fewer digest values than digest names are rejected
+short_digest_list() {
+  mkdir tree
+  echo a > tree/a
+  "$PHANTOM" -d md5,sha1 -O tree | sed 's/:[0-9a-f]* , / , /' > short.txt
+  ! "$PHANTOM" -d md5,sha1 -c short.txt tree
+  ! "$PHANTOM" -d md5,sha1 -S -c short.txt tree
+  ! "$PHANTOM" -M short.txt
+}
+
+
+check empty_db_roundtrip
+check torn_journal_resume
+check piped_reference
+check short_digest_list
+
+exit $FAILED
@@ -0,0 +1,242 @@
+// this file implements phantom's hot path tracing
+//
+// (C) Markus Dittrich 2015
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "trace.hpp"
+
+
+std::atomic<bool> traceEnabled{false};
+
+
+static const char* stageNames[numTraceStages] = {
+  "lstat", "opendir", "readdir", "open", "read", "digest"
+};
+
+
+// TraceEvent is a single complete event
+struct TraceEvent {
+  long long start;
+  long long dur;
+  TraceStage stage;
+};
+
+
+// TraceThread is a thread which recorded into a ThreadTrace. Its events
+// start at firstEvent and end where those of the next thread start.
+struct TraceThread {
+  int tid;
+  std::string name;
+  size_t firstEvent;
+};
+
+
+// ThreadTrace holds the events and per stage totals of a thread. It is only
+// ever written by its owning thread (traces of exited threads are handed on
+// under registryMx to later threads which record under their own tid) and
+// read once all traced threads have been joined.
+struct ThreadTrace {
+  std::vector<TraceThread> threads;
+  std::vector<TraceEvent> events;
+  std::array<long long, numTraceStages> count{};
+  std::array<long long, numTraceStages> time{};
+  long long dropped = 0;
+  bool live = true;        // owned by a running thread
+};
+
+
+// the thread traces are owned by the registry so they outlive their threads
+static std::mutex registryMx;
+static std::vector<std::unique_ptr<ThreadTrace>> registry;
+static int numThreads = 0;
+static const long long traceStart = trace_now();
+
+
+// TraceSlot hands the trace of a thread back to the registry when the
+// thread exits. Later threads record into free traces under their own tid
+// so the registry only grows with the number of concurrently traced
+// threads.
+struct TraceSlot {
+  ThreadTrace* trace = nullptr;
+
+  ~TraceSlot() {
+    if (trace != nullptr) {
+      std::lock_guard<std::mutex> lg(registryMx);
+      trace->live = false;
+    }
+  }
+};
+
+
+// thread_trace returns the trace of the calling thread, picking a free or
+// registering a new one on first use. Every thread gets its own tid.
+static ThreadTrace& thread_trace() {
+  thread_local TraceSlot slot;
+  if (slot.trace == nullptr) {
+    std::lock_guard<std::mutex> lg(registryMx);
+    for (const auto& t : registry) {
+      if (!t->live) {
+        slot.trace = t.get();
+        break;
+      }
+    }
+    if (slot.trace == nullptr) {
+      registry.push_back(std::make_unique<ThreadTrace>());
+      slot.trace = registry.back().get();
+    }
+    slot.trace->live = true;
+    int tid = ++numThreads;
+    slot.trace->threads.push_back({tid, "thread " + std::to_string(tid),
+      slot.trace->events.size()});
+  }
+  return *slot.trace;
+}
+
+
+// trace_record records an event of stage which started at start and ends now
+void trace_record(TraceStage stage, long long start) {
+  long long dur = trace_now() - start;
+  auto& t = thread_trace();
+  int s = static_cast<int>(stage);
+  ++t.count[s];
+  t.time[s] += dur;
+  if (t.events.size() < maxTraceEvents) {
+    t.events.push_back({start, dur, stage});
+  } else {
+    ++t.dropped;
+  }
+}
+
+
+// trace_thread_name names the calling thread in the trace
+void trace_thread_name(const std::string& name) {
+  if (!trace_enabled()) {
+    return;
+  }
+  auto& t = thread_trace();
+  std::lock_guard<std::mutex> lg(registryMx);
+  t.threads.back().name = name;
+}
+
+
+// write_us writes a ns time as fractional microseconds as expected by the
+// trace viewers
+static void write_us(std::ostream& os, long long ns) {
+  os << ns / 1000 << "." << std::setw(3) << std::setfill('0') << ns % 1000
+     << std::setfill(' ');
+}
+
+
+// write_json_string writes s as a quoted JSON string
+static void write_json_string(std::ostream& os, const std::string& s) {
+  os << '"';
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      os << buf;
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+
+// write_trace writes all recorded events as Chrome trace JSON to path
+void write_trace(const std::string& path) {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("failed to open trace file " + path);
+  }
+
+  std::lock_guard<std::mutex> lg(registryMx);
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  bool first = true;
+  for (const auto& t : registry) {
+    for (size_t i = 0; i < t->threads.size(); ++i) {
+      const auto& th = t->threads[i];
+      size_t end = i + 1 < t->threads.size() ? t->threads[i+1].firstEvent
+        : t->events.size();
+      out << (first ? "" : ",\n")
+          << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+          << th.tid << ",\"args\":{\"name\":";
+      write_json_string(out, th.name);
+      out << "}}";
+      first = false;
+      for (size_t k = th.firstEvent; k < end; ++k) {
+        const auto& e = t->events[k];
+        out << ",\n{\"name\":\"" << stageNames[static_cast<int>(e.stage)]
+            << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << th.tid << ",\"ts\":";
+        write_us(out, e.start - traceStart);
+        out << ",\"dur\":";
+        write_us(out, e.dur);
+        out << "}";
+      }
+    }
+  }
+  out << "\n],\n\"stageTotals\":{";
+
+  // aggregate totals are included so they can be processed without
+  // recomputing them from the (possibly truncated) event list
+  for (int s = 0; s < numTraceStages; ++s) {
+    long long count = 0;
+    long long time = 0;
+    for (const auto& t : registry) {
+      count += t->count[s];
+      time += t->time[s];
+    }
+    out << (s == 0 ? "" : ",") << "\n\"" << stageNames[s] << "\":{\"count\":"
+        << count << ",\"time_ns\":" << time << "}";
+  }
+  out << "\n}}\n";
+
+  if (!out) {
+    throw std::runtime_error("failed to write trace file " + path);
+  }
+}
+
+
+// print_trace_summary prints the aggregate time spent per stage to os
+void print_trace_summary(std::ostream& os) {
+  std::lock_guard<std::mutex> lg(registryMx);
+  std::array<long long, numTraceStages> count{};
+  std::array<long long, numTraceStages> time{};
+  long long total = 0;
+  long long dropped = 0;
+  for (const auto& t : registry) {
+    for (int s = 0; s < numTraceStages; ++s) {
+      count[s] += t->count[s];
+      time[s] += t->time[s];
+      total += t->time[s];
+    }
+    dropped += t->dropped;
+  }
+
+  os << "trace stage breakdown (time summed over all threads):\n"
+     << std::fixed << std::setprecision(2);
+  for (int s = 0; s < numTraceStages; ++s) {
+    os << "  " << std::left << std::setw(10) << stageNames[s] << std::right
+       << std::setw(12) << count[s] << " events "
+       << std::setw(12) << time[s] / 1e6 << " ms "
+       << std::setw(10) << (count[s] > 0 ? time[s] / 1e3 / count[s] : 0.0)
+       << " us/event "
+       << std::setw(7) << (total > 0 ? 100.0 * time[s] / total : 0.0) << " %\n";
+  }
+  if (dropped > 0) {
+    os << "  " << dropped << " events exceeded the per thread limit and are "
+       << "only included in the totals\n";
+  }
+  os.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,97 @@
+// trace provides low overhead per thread tracing of phantom's hot path
+// stages (lstat, opendir, readdir, open, read and digest updates). Tracing
+// is always compiled in but switched off by default; when disabled a trace
+// scope costs a single relaxed load and branch. When enabled each thread
+// records timestamped events into its own buffer so that no locks are taken
+// on the hot path. At the end of a run the events are written as a
+// Chrome/Perfetto trace (JSON object format with complete "X" events)
+// together with an aggregate per stage time breakdown.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+
+
+// TraceStage enumerates the traced pipeline stages
+enum class TraceStage : unsigned char {
+  lstat,
+  opendir,
+  readdir,
+  open,
+  read,
+  digest,
+  numStages
+};
+
+const int numTraceStages = static_cast<int>(TraceStage::numStages);
+
+
+// maximum number of events kept per thread; further events only feed the
+// per stage totals so memory use stays bounded on huge trees
+const size_t maxTraceEvents = 1 << 20;
+
+
+// traceEnabled switches tracing on; it has to be set before any traced
+// threads are started
+extern std::atomic<bool> traceEnabled;
+
+
+inline bool trace_enabled() {
+  return traceEnabled.load(std::memory_order_relaxed);
+}
+
+
+// trace_now returns the current time in ns on the clock used for tracing
+inline long long trace_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// trace_record records an event of stage which started at start and ends now
+void trace_record(TraceStage stage, long long start);
+
+
+// trace_thread_name names the calling thread in the trace
+void trace_thread_name(const std::string& name);
+
+
+// write_trace writes all recorded events as Chrome trace JSON to path.
+// Throws std::runtime_error if the file can not be written.
+void write_trace(const std::string& path);
+
+
+// print_trace_summary prints the aggregate time spent per stage to os
+void print_trace_summary(std::ostream& os);
+
+
+// TraceScope records an event spanning its lifetime if tracing is enabled
+class TraceScope {
+
+public:
+
+  explicit TraceScope(TraceStage stage) : stage_(stage),
+    start_(trace_enabled() ? trace_now() : -1) {};
+
+  ~TraceScope() {
+    if (start_ >= 0) {
+      trace_record(stage_, start_);
+    }
+  }
+
+  TraceScope(const TraceScope& t) = delete;
+  TraceScope& operator=(const TraceScope& t) = delete;
+
+private:
+
+  TraceStage stage_;
+  long long start_;
+};
+
+#endif
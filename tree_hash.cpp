@@ -0,0 +1,350 @@
+// this file implements chunked Merkle tree digests
+//
+// (C) Markus Dittrich, 2015
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "reader.hpp"
+#include "trace.hpp"
+#include "tree_hash.hpp"
+#include "util.hpp"
+
+
+static const unsigned char leafPrefix = 0x00;
+static const unsigned char nodePrefix = 0x01;
+
+static std::string combine(const EVP_MD* md, std::vector<std::string> level);
+static std::string raw_final(EvpDigest& d);
+
+
+// parse_tree_digest returns true if name is a valid tree digest name and
+// fills in spec accordingly
+bool parse_tree_digest(const std::string& name, TreeSpec& spec) {
+  const std::string prefix = "tree-";
+  if (name.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  auto md = name.substr(prefix.size());
+  size_t chunkSize = defaultTreeChunkSize;
+  auto slash = md.find('/');
+  if (slash != std::string::npos) {
+    auto kb = md.substr(slash + 1);
+    if (kb.empty() || kb.find_first_not_of("0123456789") != std::string::npos) {
+      return false;
+    }
+    chunkSize = std::stoull(kb) * 1024;
+    if (chunkSize == 0) {
+      return false;
+    }
+    md = md.substr(0, slash);
+  }
+  if (md != "md5" && md != "sha1" && md != "ripemd160") {
+    return false;
+  }
+
+  spec.md = md;
+  spec.chunkSize = chunkSize;
+  return true;
+}
+
+
+// TreeDigest computes a tree digest sequentially from a stream of data
+TreeDigest::TreeDigest(const TreeSpec& spec) : spec_(spec) {
+  md_ = evp_digest(spec_.md);
+}
+
+
+void TreeDigest::update(const char* buf, size_t size) {
+  while (size > 0) {
+    if (!leaf_) {
+      leaf_ = std::make_unique<EvpDigest>(md_);
+      leaf_->update(reinterpret_cast<const char*>(&leafPrefix), 1);
+      leafFill_ = 0;
+    }
+    size_t n = std::min(size, spec_.chunkSize - leafFill_);
+    leaf_->update(buf, n);
+    leafFill_ += n;
+    buf += n;
+    size -= n;
+    if (leafFill_ == spec_.chunkSize) {
+      finish_leaf();
+    }
+  }
+}
+
+
+std::string TreeDigest::final() {
+  // empty files consist of a single empty chunk
+  if (!leaf_ && leaves_.empty()) {
+    leaf_ = std::make_unique<EvpDigest>(md_);
+    leaf_->update(reinterpret_cast<const char*>(&leafPrefix), 1);
+  }
+  if (leaf_) {
+    finish_leaf();
+  }
+  auto root = combine(md_, std::move(leaves_));
+  leaves_.clear();
+  return to_hex(reinterpret_cast<const unsigned char*>(root.data()), root.size());
+}
+
+
+void TreeDigest::reset() {
+  leaf_.reset();
+  leafFill_ = 0;
+  leaves_.clear();
+}
+
+
+void TreeDigest::finish_leaf() {
+  leaves_.push_back(raw_final(*leaf_));
+  leaf_.reset();
+}
+
+
+// TreeJob is the state of a single tree digest shared by the calling hash
+// thread and the pool helpers working on it. Helpers may pick up a job after
+// all its chunks were taken, so the job is reference counted and closed by
+// the caller once it is done; later helpers then return right away. The
+// caller also withdraws the requests still queued in the pool so the job
+// (and its file descriptor) is released as soon as the file is hashed.
+struct TreeJob {
+  TreeJob(const TreeSpec& spec, const std::string& path, size_t bufSize)
+    : spec(spec), path(path), fd(path, O_RDONLY), bufSize(bufSize) {}
+
+  // work hashes chunks until all are taken (or a read failed)
+  void work();
+
+  // hash_chunks is run by the caller as well as helpers
+  void hash_chunks();
+
+  const TreeSpec spec;
+  const std::string path;
+  Fd fd;
+  size_t bufSize;
+  off_t size = 0;
+  const EVP_MD* md = nullptr;
+  size_t numChunks = 0;
+  std::vector<std::string> leaves;
+  std::atomic<size_t> nextChunk{0};
+  std::atomic<bool> failed{false};
+
+  std::mutex mx;
+  std::condition_variable cv;
+  bool closed = false;    // no more helpers may join
+  int active = 0;         // helpers currently working on the job
+};
+
+
+// TreePool is the process wide pool of helper threads for tree digests.
+// It is shared by all hash threads so the number of threads hashing chunks
+// stays bounded by --tree_threads no matter how many large files are hashed
+// at once, and threads are only created once.
+class TreePool {
+
+public:
+
+  // instance returns the pool which is created with numThreads - 1 helpers
+  // on first use
+  static TreePool& instance(int numThreads) {
+    static TreePool pool(numThreads - 1);
+    return pool;
+  }
+
+  ~TreePool() {
+    {
+      std::lock_guard<std::mutex> lg(mx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+      t.join();
+    }
+  }
+
+  size_t size() const {
+    return threads_.size();
+  }
+
+  // post asks up to n helpers to work on job
+  void post(const std::shared_ptr<TreeJob>& job, size_t n) {
+    {
+      std::lock_guard<std::mutex> lg(mx_);
+      for (size_t i = 0; i < n; ++i) {
+        jobs_.push_back(job);
+      }
+    }
+    cv_.notify_all();
+  }
+
+  // cancel drops the requests for job which no helper picked up yet
+  void cancel(const std::shared_ptr<TreeJob>& job) {
+    std::lock_guard<std::mutex> lg(mx_);
+    jobs_.erase(std::remove(jobs_.begin(), jobs_.end(), job), jobs_.end());
+  }
+
+private:
+
+  TreePool(int numHelpers) {
+    for (int i = 0; i < numHelpers; ++i) {
+      threads_.push_back(std::thread(&TreePool::run, this));
+    }
+  }
+
+  void run() {
+    trace_thread_name("tree helper");
+    while (true) {
+      std::shared_ptr<TreeJob> job;
+      {
+        std::unique_lock<std::mutex> lk(mx_);
+        cv_.wait(lk, [&]() { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job->work();
+    }
+  }
+
+  std::mutex mx_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<TreeJob>> jobs_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+
+// work registers a helper with the job unless the caller already closed it
+void TreeJob::work() {
+  {
+    std::lock_guard<std::mutex> lg(mx);
+    if (closed) {
+      return;
+    }
+    ++active;
+  }
+  hash_chunks();
+  {
+    std::lock_guard<std::mutex> lg(mx);
+    --active;
+  }
+  cv.notify_all();
+}
+
+
+// hash_chunks grabs the next unprocessed chunk until all are done
+void TreeJob::hash_chunks() {
+  AlignedBuffer buffer(bufSize);
+  size_t c;
+  while (!failed && (c = nextChunk.fetch_add(1)) < numChunks) {
+    EvpDigest leaf(md);
+    leaf.update(reinterpret_cast<const char*>(&leafPrefix), 1);
+    off_t offset = c * spec.chunkSize;
+    off_t end = std::min<off_t>(offset + spec.chunkSize, size);
+    while (offset < end) {
+      size_t want = std::min<off_t>(buffer.size(), end - offset);
+      ssize_t n;
+      {
+        TraceScope ts(TraceStage::read);
+        n = pread(fd.get(), buffer.get(), want, offset);
+      }
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n <= 0) {
+        failed = true;
+        break;
+      }
+      {
+        TraceScope ts(TraceStage::digest);
+        leaf.update(buffer.get(), n);
+      }
+      offset += n;
+    }
+    leaves[c] = raw_final(leaf);
+  }
+}
+
+
+// tree_hash computes the tree digest of the file at path. The calling
+// thread hashes chunks itself and asks idle helpers of the shared pool to
+// join in, so a file is always finished even if all helpers are busy.
+std::string tree_hash(const TreeSpec& spec, const std::string& path,
+  int numThreads, size_t bufSize) {
+
+  auto job = std::make_shared<TreeJob>(spec, path, bufSize);
+  struct stat info;
+  if (fstat(job->fd.get(), &info) < 0) {
+    throw FailedFileAccess(path);
+  }
+
+  job->size = info.st_size;
+  job->md = evp_digest(spec.md);
+  job->numChunks = (info.st_size + spec.chunkSize - 1) / spec.chunkSize;
+  if (job->numChunks == 0) {
+    job->numChunks = 1;
+  }
+  job->leaves.resize(job->numChunks);
+
+  TreePool* pool = nullptr;
+  if (numThreads > 1 && job->numChunks > 1) {
+    pool = &TreePool::instance(numThreads);
+    pool->post(job, std::min(pool->size(), job->numChunks - 1));
+  }
+  job->hash_chunks();
+  if (pool != nullptr) {
+    pool->cancel(job);
+  }
+  {
+    std::unique_lock<std::mutex> lk(job->mx);
+    job->closed = true;
+    job->cv.wait(lk, [&]() { return job->active == 0; });
+  }
+  if (job->failed) {
+    throw FailedFileAccess(path);
+  }
+
+  auto root = combine(job->md, std::move(job->leaves));
+  return to_hex(reinterpret_cast<const unsigned char*>(root.data()), root.size());
+}
+
+
+// combine reduces a level of raw digests pairwise until only the root is left
+static std::string combine(const EVP_MD* md, std::vector<std::string> level) {
+  while (level.size() > 1) {
+    std::vector<std::string> next;
+    for (size_t i = 0; i < level.size(); i += 2) {
+      if (i + 1 == level.size()) {
+        next.push_back(std::move(level[i]));
+        break;
+      }
+      EvpDigest node(md);
+      node.update(reinterpret_cast<const char*>(&nodePrefix), 1);
+      node.update(level[i].data(), level[i].size());
+      node.update(level[i+1].data(), level[i+1].size());
+      next.push_back(raw_final(node));
+    }
+    level = std::move(next);
+  }
+  return level[0];
+}
+
+
+// raw_final finalizes d and returns the raw digest bytes
+static std::string raw_final(EvpDigest& d) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int length = d.final_raw(digest);
+  return std::string(reinterpret_cast<const char*>(digest), length);
+}
@@ -0,0 +1,72 @@
+// this file implements chunked Merkle tree digests. A file is split into
+// fixed size chunks which are hashed independently (and hence possibly
+// concurrently); the chunk digests are then combined pairwise into a single
+// root digest:
+//
+//   leaf  = H(0x00 || chunk)
+//   node  = H(0x01 || left || right)
+//
+// An unpaired node at the end of a level is promoted unchanged. Empty files
+// consist of a single empty chunk. Tree digests are named tree-<md> (using
+// the default chunk size) or tree-<md>/<chunk size in KB>, e.g. tree-sha1 or
+// tree-md5/4096.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef TREE_HASH_HPP
+#define TREE_HASH_HPP
+
+#include <string>
+#include <vector>
+
+#include "digest.hpp"
+
+
+// default chunk size of tree digests in bytes
+const size_t defaultTreeChunkSize = 16*1024*1024;
+
+
+// TreeSpec describes the parameters of a tree digest
+struct TreeSpec {
+  std::string md;        // name of the underlying EVP digest
+  size_t chunkSize = defaultTreeChunkSize;
+};
+
+
+// parse_tree_digest returns true if name is a valid tree digest name and
+// fills in spec accordingly
+bool parse_tree_digest(const std::string& name, TreeSpec& spec);
+
+
+// TreeDigest computes a tree digest sequentially from a stream of data
+class TreeDigest : public Digest {
+
+public:
+
+  TreeDigest(const TreeSpec& spec);
+
+  void update(const char* buf, size_t size) override;
+  std::string final() override;
+  void reset() override;
+
+private:
+
+  void finish_leaf();
+
+  TreeSpec spec_;
+  const EVP_MD* md_;
+  std::unique_ptr<EvpDigest> leaf_;
+  size_t leafFill_ = 0;
+  std::vector<std::string> leaves_;
+};
+
+
+// tree_hash computes the tree digest of the file at path. Chunks are hashed
+// concurrently by the calling thread and the helpers of a process wide pool
+// of numThreads - 1 threads (sized on first use) shared by all callers.
+// Each thread reads its chunks via pread in pieces of bufSize bytes. Throws
+// FailedFileAccess if the file can not be read.
+std::string tree_hash(const TreeSpec& spec, const std::string& path,
+  int numThreads, size_t bufSize);
+
+#endif
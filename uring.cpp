@@ -0,0 +1,193 @@
+// Uring is a minimal wrapper around the Linux io_uring interface providing
+// just enough functionality (submission of reads and reaping of completions)
+// for phantom's asynchronous read engine.
+//
+// (C) Markus Dittrich, 2015
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.hpp"
+
+
+// create a ring with room for (at least) depth submissions. On systems
+// without io_uring support (or where it is blocked) ok() returns false.
+Uring::Uring(unsigned int depth) {
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ringFd_ = syscall(__NR_io_uring_setup, depth, &p);
+  if (ringFd_ < 0) {
+    return;
+  }
+  if (!supports_read()) {
+    close(ringFd_);
+    ringFd_ = -1;
+    return;
+  }
+
+  sqSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) {
+    sqSize_ = cqSize_ = (sqSize_ > cqSize_ ? sqSize_ : cqSize_);
+  }
+
+  sqPtr_ = mmap(NULL, sqSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    ringFd_, IORING_OFF_SQ_RING);
+  if (sqPtr_ == MAP_FAILED) {
+    sqPtr_ = nullptr;
+    close(ringFd_);
+    ringFd_ = -1;
+    return;
+  }
+
+  if (single) {
+    cqPtr_ = sqPtr_;
+  } else {
+    cqPtr_ = mmap(NULL, cqSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ringFd_, IORING_OFF_CQ_RING);
+    if (cqPtr_ == MAP_FAILED) {
+      cqPtr_ = nullptr;
+      munmap(sqPtr_, sqSize_);
+      sqPtr_ = nullptr;
+      close(ringFd_);
+      ringFd_ = -1;
+      return;
+    }
+  }
+
+  sqesSize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (cqPtr_ != sqPtr_) {
+      munmap(cqPtr_, cqSize_);
+    }
+    munmap(sqPtr_, sqSize_);
+    sqPtr_ = cqPtr_ = nullptr;
+    close(ringFd_);
+    ringFd_ = -1;
+    return;
+  }
+  sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  char* sq = static_cast<char*>(sqPtr_);
+  sqHead_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  sqMask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  sqEntries_ = p.sq_entries;
+
+  char* cq = static_cast<char*>(cqPtr_);
+  cqHead_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  cqMask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+#else
+  (void)depth;
+#endif
+}
+
+
+// supports_read probes the kernel for IORING_OP_READ. Kernels before 5.6
+// have io_uring but neither the opcode nor the probe and would fail every
+// read with -EINVAL.
+bool Uring::supports_read() const {
+#if defined(__NR_io_uring_register) && defined(IO_URING_OP_SUPPORTED)
+  const unsigned numOps = 256;
+  std::vector<char> buf(sizeof(struct io_uring_probe)
+    + numOps * sizeof(struct io_uring_probe_op));
+  auto probe = reinterpret_cast<struct io_uring_probe*>(buf.data());
+  if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PROBE, probe,
+      numOps) < 0) {
+    return false;
+  }
+  return IORING_OP_READ <= probe->last_op
+    && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+#else
+  return false;
+#endif
+}
+
+
+Uring::~Uring() {
+  if (ringFd_ < 0) {
+    return;
+  }
+  munmap(sqes_, sqesSize_);
+  if (cqPtr_ != sqPtr_) {
+    munmap(cqPtr_, cqSize_);
+  }
+  munmap(sqPtr_, sqSize_);
+  close(ringFd_);
+}
+
+
+// queue a read of size bytes at offset into buf
+bool Uring::prep_read(int fd, char* buf, size_t size, off_t offset,
+  unsigned long long userData) {
+
+  unsigned tail = *sqTail_;
+  unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+  if (tail - head >= sqEntries_) {
+    return false;
+  }
+
+  unsigned idx = tail & *sqMask_;
+  struct io_uring_sqe* sqe = &sqes_[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<unsigned long long>(buf);
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->user_data = userData;
+  sqArray_[idx] = idx;
+
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+  ++toSubmit_;
+  return true;
+}
+
+
+// submit all queued requests and wait for at least minComplete completions
+bool Uring::submit(unsigned int minComplete) {
+#ifdef __NR_io_uring_enter
+  unsigned int flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (true) {
+    int ret = syscall(__NR_io_uring_enter, ringFd_, toSubmit_, minComplete,
+      flags, NULL, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    toSubmit_ -= ret;
+    return true;
+  }
+#else
+  (void)minComplete;
+  return false;
+#endif
+}
+
+
+// reap a single completion if available
+bool Uring::reap(unsigned long long& userData, int& res) {
+  unsigned head = *cqHead_;
+  if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  struct io_uring_cqe* cqe = &cqes_[head & *cqMask_];
+  userData = cqe->user_data;
+  res = cqe->res;
+  __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
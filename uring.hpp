@@ -0,0 +1,71 @@
+// Uring is a minimal wrapper around the Linux io_uring interface providing
+// just enough functionality (submission of reads and reaping of completions)
+// for phantom's asynchronous read engine. It talks to the kernel via raw
+// syscalls so no liburing is required.
+//
+// (C) Markus Dittrich, 2015
+
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <sys/types.h>
+
+#include <linux/io_uring.h>
+
+
+class Uring {
+
+public:
+
+  // create a ring with room for (at least) depth submissions. Use ok() to
+  // check if io_uring (including IORING_OP_READ) is available on this
+  // system.
+  Uring(unsigned int depth);
+  ~Uring();
+
+  Uring(const Uring& u) = delete;
+  Uring& operator=(const Uring& u) = delete;
+
+  bool ok() const { return ringFd_ >= 0; }
+
+  // queue a read of size bytes at offset into buf. The request is handed to
+  // the kernel at the next call to submit(). Returns false if the
+  // submission queue is full.
+  bool prep_read(int fd, char* buf, size_t size, off_t offset,
+    unsigned long long userData);
+
+  // submit all queued requests and wait for at least minComplete completions
+  bool submit(unsigned int minComplete);
+
+  // reap a single completion if available. Returns false if none are
+  // pending.
+  bool reap(unsigned long long& userData, int& res);
+
+private:
+
+  bool supports_read() const;
+
+  int ringFd_ = -1;
+
+  // submission queue
+  void* sqPtr_ = nullptr;
+  size_t sqSize_ = 0;
+  unsigned* sqTail_;
+  unsigned* sqHead_;
+  unsigned* sqMask_;
+  unsigned* sqArray_;
+  struct io_uring_sqe* sqes_ = nullptr;
+  size_t sqesSize_ = 0;
+  unsigned int sqEntries_;
+  unsigned int toSubmit_ = 0;
+
+  // completion queue
+  void* cqPtr_ = nullptr;
+  size_t cqSize_ = 0;
+  unsigned* cqHead_;
+  unsigned* cqTail_;
+  unsigned* cqMask_;
+  struct io_uring_cqe* cqes_;
+};
+
+#endif
@@ -2,66 +2,152 @@
 //
 // (C) Markus Dittrich, 2015
 
+#include <cerrno>
 #include <cstddef>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <vector>
 
+#include "fast_digest.hpp"
 #include "stats.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
 
-// add_directory adds the content of the provided directory to the queue
-void add_directory(StringQueue& queue, const std::string& path, const Printer& print) {
+static void print_histogram(const std::string& name, const Histogram& hist,
+  std::string (*format)(unsigned long long));
 
-  try {
-    Dir dir(path);
 
-    size_t length = dirent_buf_size(dir.get());
-    struct dirent *entry, *end;
-    if ((entry = (struct dirent*)malloc(length)) == NULL) {
-      error("failed to malloc struct dirent");
+// linux_dirent64 is the directory entry record returned by getdents64
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+
+// reserve_dir_fd returns true if another directory descriptor can be kept
+// open for the queued entries of a directory. At most half of the
+// descriptor limit is used for directories so files can still be opened.
+static std::atomic<long> openDirFds{0};
+
+static bool reserve_dir_fd() {
+  static const long budget = []() {
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) < 0 || lim.rlim_cur == RLIM_INFINITY) {
+      return 512L;
     }
+    return static_cast<long>(lim.rlim_cur / 2);
+  }();
+  if (openDirFds.fetch_add(1, std::memory_order_relaxed) < budget) {
+    return true;
+  }
+  openDirFds.fetch_sub(1, std::memory_order_relaxed);
+  return false;
+}
+
+
+// add_directory adds the subdirectories of the provided directory to the
+// deque of thread id and the contained regular files to the file queue.
+// Entries are read in large batches via getdents64 and files are queued
+// relative to the shared directory handle without building their path.
+// In a sharded scan only the files and subdirectories owned by the shard
+// are queued (see shard.hpp).
+void add_directory(StringWSQueue& dirQueue, int id, FileQueue& fileQueue,
+  const std::string& path, const Shard& shard, const Printer& print) {
+
+  int fd;
+  {
+    TraceScope ts(TraceStage::opendir);
+    fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  if (fd < 0) {
+    std::cerr << FailedDirAccess(path).what() << "\n";
+    return;
+  }
 
-    int status;
-    while ((status = readdir_r(dir.get(), entry, &end) == 0) && (end != NULL)) {
+  // trailing '/'s are dropped so entry paths are of the form dir/name
+  size_t end = path.find_last_not_of("/");
+  std::string dirPath = path.substr(0, end == std::string::npos ? 0 : end + 1);
+  bool keep = reserve_dir_fd();
+  auto dir = std::make_shared<const DirHandle>(dirPath, keep ? fd : -1);
+
+  // subdirectories at the shard depth are only queued if owned
+  int depth = 0;
+  bool ownFiles = true;
+  if (shard.enabled()) {
+    depth = shard.depth_of(dirPath);
+    ownFiles = depth >= shard.depth || shard.owns(dirPath);
+  }
 
-      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+  thread_local std::vector<uint64_t> buf(dirBufferSize / sizeof(uint64_t));
+  char* data = reinterpret_cast<char*>(buf.data());
+  while (true) {
+    long n;
+    {
+      TraceScope ts(TraceStage::readdir);
+      n = syscall(SYS_getdents64, fd, data, dirBufferSize);
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      error("add_directory(): failed to read directory " + path);
+    } else if (n == 0) {
+      break;
+    }
+
+    for (long off = 0; off < n;) {
+      auto entry = reinterpret_cast<const linux_dirent64*>(data + off);
+      off += entry->d_reclen;
+      const char* name = entry->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
         continue;
       }
 
-      // we use d_type to figure out what type entries are. However, since d_type
-      // is not that portable it may be better to use lstat instead.
-      if (entry->d_type == DT_DIR || entry->d_type == DT_REG) {
-        std::string p(path);
-        std::string name(entry->d_name);
-        std::string path = concat_filepaths(p, name);
-        queue.push(path);
+      // we use d_type to figure out what type entries are. Filesystems which
+      // don't support d_type report DT_UNKNOWN and we fall back to lstat.
+      unsigned char type = entry->d_type;
+      if (type == DT_UNKNOWN) {
+        struct stat info;
+        TraceScope ts(TraceStage::lstat);
+        if (fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) < 0) {
+          print.cerr("lstat failed on " + dirPath + "/" + name);
+          continue;
+        }
+        type = S_ISDIR(info.st_mode) ? DT_DIR : (S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN);
+      }
+      if (type == DT_DIR) {
+        std::string subDir;
+        subDir.reserve(dirPath.size() + 1 + strlen(name));
+        subDir.append(dirPath).append("/").append(name);
+        if (shard.enabled() && depth + 1 == shard.depth && !shard.owns(subDir)) {
+          continue;
+        }
+        dirQueue.push(id, std::move(subDir));
+      } else if (type == DT_REG && ownFiles) {
+        FileEntry file;
+        file.dir = dir;
+        file.name = name;
+        file.ino = entry->d_ino;
+        fileQueue.push(std::move(file));
       }
     }
-    if (status != 0 && end != NULL) {
-      error("add_dir_to_queue(): Failed to parse directory.");
-    }
-    free(entry);
-  } catch (FailedDirAccess e) {
-    std::cerr << e.what() << "\n";
-    return;
   }
-}
-
-
-// helper function to compute the buf size required for dirent for
-// the particular filesystem in use. Code adapted from
-// http://womble.decadent.org.uk/readdir_r-advisory.html
-size_t dirent_buf_size(DIR* dirp) {
-  long name_max = fpathconf(dirfd(dirp), _PC_NAME_MAX);
-  if (name_max == -1) {
-    error("fpathconf failed");
+  if (!keep) {
+    close(fd);
   }
-  size_t name_end = (size_t)offsetof(struct dirent, d_name) + name_max + 1;
-  return (name_end > sizeof(struct dirent) ? name_end : sizeof(struct dirent));
 }
 
 
@@ -76,60 +162,263 @@ std::string concat_filepaths(std::string& s1, const std::string& s2) {
 }
 
 
-// File is a thin wrapper class for managing C style filepointers
-File::File(const std::string& fileName) {
-  fp_ = fopen(fileName.c_str(), "r");
-  if (fp_ == NULL) {
+// Fd is a thin wrapper class for managing POSIX file descriptors. Filesystems
+// which do not support O_DIRECT (e.g. tmpfs) reject it with EINVAL in which
+// case we fall back to regular buffered I/O. O_NOATIME is only permitted
+// for the owner of a file and dropped otherwise.
+Fd::Fd(const std::string& fileName, int flags) {
+  TraceScope ts(TraceStage::open);
+  fd_ = open(fileName.c_str(), flags);
+  if (fd_ < 0 && errno == EINVAL && (flags & O_DIRECT)) {
+    fd_ = open(fileName.c_str(), flags & ~O_DIRECT);
+  }
+  if (fd_ < 0 && errno == EPERM && (flags & O_NOATIME)) {
+    fd_ = open(fileName.c_str(), flags & ~O_NOATIME);
+  }
+  if (fd_ < 0) {
     throw FailedFileAccess(fileName);
   }
 }
 
 
-File::~File() {
-  fclose(fp_);
+Fd::~Fd() {
+  close(fd_);
 }
 
 
-FILE* File::get() {
-  return fp_;
+int Fd::get() {
+  return fd_;
 }
 
 
-// Dir is a thin wrapper class for managing C style directory pointers
-Dir::Dir(const std::string& dirName) {
-  dp_ = opendir(dirName.c_str());
-  if (dp_ == NULL) {
-    throw FailedDirAccess(dirName);
+Fd::Fd(const FileEntry& file, int flags) {
+  TraceScope ts(TraceStage::open);
+  fd_ = file.open(flags);
+  if (fd_ < 0 && errno == EINVAL && (flags & O_DIRECT)) {
+    fd_ = file.open(flags & ~O_DIRECT);
+  }
+  if (fd_ < 0 && errno == EPERM && (flags & O_NOATIME)) {
+    fd_ = file.open(flags & ~O_NOATIME);
+  }
+  if (fd_ < 0) {
+    throw FailedFileAccess(file.path());
   }
 }
 
 
-Dir::~Dir() {
-  closedir(dp_);
+DirHandle::DirHandle(std::string path, int fd) : path_(std::move(path)),
+  fd_(fd) {}
+
+
+DirHandle::~DirHandle() {
+  if (fd_ >= 0) {
+    close(fd_);
+    openDirFds.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+
+// device returns the (cached) device of the directory. Directories whose
+// descriptor was not kept open (see add_directory) are stat'ed by path.
+bool DirHandle::device(dev_t& dev) const {
+  if (haveDev_.load(std::memory_order_acquire)) {
+    dev = dev_.load(std::memory_order_relaxed);
+    return true;
+  }
+  struct stat info;
+  int rc = fd_ >= 0 ? fstat(fd_, &info) : stat(path_.c_str(), &info);
+  if (rc < 0) {
+    return false;
+  }
+  dev_.store(info.st_dev, std::memory_order_relaxed);
+  haveDev_.store(true, std::memory_order_release);
+  dev = info.st_dev;
+  return true;
 }
 
 
-DIR* Dir::get() {
-  return dp_;
+// path stores the full path of the entry in out
+void FileEntry::path(std::string& out) const {
+  out.clear();
+  if (dir) {
+    out.append(dir->path()).append("/");
+  }
+  out.append(name);
+}
+
+
+std::string FileEntry::path() const {
+  std::string out;
+  path(out);
+  return out;
+}
+
+
+// at_name returns the name to pass to the *at() system calls along with the
+// directory descriptor. Only if the directory has no descriptor the full
+// path is built (in buf).
+const char* FileEntry::at_name(std::string& buf) const {
+  if (!dir || dir->fd() != AT_FDCWD) {
+    return name.c_str();
+  }
+  path(buf);
+  return buf.c_str();
+}
+
+
+int FileEntry::open(int flags) const {
+  thread_local std::string buf;
+  return openat(dir ? dir->fd() : AT_FDCWD, at_name(buf), flags);
+}
+
+
+int FileEntry::lstat(struct stat* info) const {
+  thread_local std::string buf;
+  return fstatat(dir ? dir->fd() : AT_FDCWD, at_name(buf), info,
+    AT_SYMLINK_NOFOLLOW);
 }
 
 
 // simple usage message
 void usage() {
   std::cout << "phantom v" << version << " (C) Markus Dittrich, 2015\n\n"
-    << "usage(): phantom [options] <root path>" << "\n\n"
+    << "usage(): phantom [options] <root path>" << "\n"
+    << "         phantom --merge [options] <manifest> ..." << "\n\n"
     << "options:\n"
     << "\t -n, --num_threads <int>         number of parallel threads used for\n"
     << "\t                                 execution of program" << "\n"
+    << "\t -w, --walk_threads <int>        number of directory walker threads\n"
+    << "\t                                 (default: num_threads)\n"
+    << "\t -H, --hash_threads <int>        number of hashing threads\n"
+    << "\t                                 (default: num_threads)\n"
+    << "\t -T, --tree_threads <int>        maximum number of threads hashing chunks\n"
+    << "\t                                 of tree digests. Helper threads are shared\n"
+    << "\t                                 by all hash threads (default: number of\n"
+    << "\t                                 cores)\n"
     << "\t -c, --compare <reference file>  path to reference file with phantom output\n"
     << "\t                                 from a previous run. In this case phantom\n"
     << "\t                                 will list all files that are missing, new or\n"
-    << "\t                                 different from the previous run.\n"
-    << "\t -d, --digest <hash name>        select hash function to use for file digests.\n"
+    << "\t                                 different from the previous run. Both text\n"
+    << "\t                                 and binary reference files are accepted.\n"
+    << "\t -o, --output_db <file>          write the results to a binary reference\n"
+    << "\t                                 database instead of printing them\n"
+    << "\t -C, --convert <reference file>  convert a text reference file to a binary\n"
+    << "\t                                 database (given via --output_db) or a\n"
+    << "\t                                 binary database to text on stdout\n"
+    << "\t -S, --streaming                 compare against a path sorted reference (a\n"
+    << "\t                                 binary database or converted text file) by\n"
+    << "\t                                 merging it with the sorted results. Memory\n"
+    << "\t                                 use stays bounded; results are sorted via\n"
+    << "\t                                 runs spilled to disk.\n"
+    << "\t -t, --tmp_dir <dir>             directory for the sort runs of streaming\n"
+    << "\t                                 and sorted mode (default: $TMPDIR or /tmp)\n"
+    << "\t -O, --sorted                    print results sorted by path so repeated\n"
+    << "\t                                 runs produce identical output\n"
+    << "\t -u, --duplicates                report groups of duplicate files instead\n"
+    << "\t                                 of per file hashes. Files are grouped by\n"
+    << "\t                                 size, then by an xxh64 hash of their first\n"
+    << "\t                                 and last 16 KB, and only files still\n"
+    << "\t                                 sharing both are fully hashed with the\n"
+    << "\t                                 requested digests. Hard links count as a\n"
+    << "\t                                 single file; empty files are skipped.\n"
+    << "\t -k, --checkpoint <journal>      append finished results to journal (in\n"
+    << "\t                                 phantom's output format) and sync it\n"
+    << "\t                                 periodically so the scan can be resumed\n"
+    << "\t -R, --resume                    resume the scan recorded in --checkpoint.\n"
+    << "\t                                 Files whose path and metadata match a\n"
+    << "\t                                 journal entry take the journaled hash\n"
+    << "\t                                 instead of being rehashed; the output is\n"
+    << "\t                                 that of a complete scan.\n"
+    << "\t -I, --checkpoint_interval <s>   seconds between journal syncs (default: 30)\n"
+    << "\t -L, --time_budget <seconds>     stop cleanly once the given time has\n"
+    << "\t                                 passed. The output is then incomplete and\n"
+    << "\t                                 phantom exits with status 2; combine with\n"
+    << "\t                                 --checkpoint to resume the scan later.\n"
+    << "\t -K, --shard <i/N>               scan only shard i (0 <= i < N) of the tree.\n"
+    << "\t                                 Directories at the shard depth are\n"
+    << "\t                                 assigned to shards by a hash of their path\n"
+    << "\t                                 relative to the root, so N processes on\n"
+    << "\t                                 one or several hosts can split a scan.\n"
+    << "\t -j, --shard_depth <depth>       depth below the root at which directories\n"
+    << "\t                                 are assigned to shards (default: 1)\n"
+    << "\t -M, --merge                     merge the shard manifests given instead of\n"
+    << "\t                                 a root path into one manifest sorted by\n"
+    << "\t                                 path, a binary database (--output_db) or\n"
+    << "\t                                 a compare report against a path sorted\n"
+    << "\t                                 reference (--compare)\n"
+    << "\t -P, --progress <seconds>        report progress (files and data processed,\n"
+    << "\t                                 rates, queue depths and ETA) at the given\n"
+    << "\t                                 interval. A report can also be requested\n"
+    << "\t                                 at any time by sending SIGUSR1.\n"
+    << "\t -F, --status_file <file>        write progress reports to file instead of\n"
+    << "\t                                 stderr\n"
+    << "\t -x, --trace <file>              record the time spent in lstat, opendir,\n"
+    << "\t                                 readdir, open, read and digest updates per\n"
+    << "\t                                 thread and write it as Chrome/Perfetto\n"
+    << "\t                                 trace JSON to file. A per stage time\n"
+    << "\t                                 breakdown is printed to stderr.\n"
+    << "\t -d, --digest <hash names>       comma separated list of hash functions to\n"
+    << "\t                                 use for file digests. All digests are\n"
+    << "\t                                 computed in a single pass over the data.\n"
     << "\t                                 Available hash functions are:\n"
-    << "\t                                 md5 (default), sha1, ripemd160\n"
-    << "\t -s, --collect_stats             collect file and processed data statistics\n"
-    << "\t                                 and print them at the end.\n"
+    << "\t                                 md5 (default), sha1, ripemd160 as well as\n"
+    << "\t                                 the chunk-parallel tree digests tree-md5,\n"
+    << "\t                                 tree-sha1 and tree-ripemd160 (16 MB chunks).\n"
+    << "\t                                 Append /<KB> to select a different chunk\n"
+    << "\t                                 size, e.g. tree-sha1/4096.\n"
+    << "\t                                 The non-cryptographic crc32c and xxh64 and\n"
+    << "\t                                 the fast cryptographic blake3 use SIMD\n"
+    << "\t                                 implementations selected at runtime.\n"
+    << "\t                                 Sampled quick-check digests sample-<md>\n"
+    << "\t                                 (e.g. sample-md5 or sample-blake3/64 for\n"
+    << "\t                                 64 instead of 16 samples) only hash the\n"
+    << "\t                                 file size plus 4 KB blocks at the head,\n"
+    << "\t                                 tail and evenly spaced in between. They\n"
+    << "\t                                 can not be combined with other digests.\n"
+    << "\t -s, --collect_stats             print file and processed data statistics\n"
+    << "\t                                 including file size and per file hash time\n"
+    << "\t                                 histograms at the end.\n"
+    << "\t -r, --read_mode <mode>          select how file data is read. Available\n"
+    << "\t                                 modes are: async (default; io_uring with\n"
+    << "\t                                 posix_fadvise fallback), read (large aligned\n"
+    << "\t                                 read() buffer), mmap and direct (O_DIRECT)\n"
+    << "\t -b, --buffer_size <KB>          size of the read buffer in KB used by the\n"
+    << "\t                                 async, read and direct modes (default: 1024)\n"
+    << "\t -q, --queue_depth <int>         number of reads kept in flight per file in\n"
+    << "\t                                 async mode (default: 4)\n"
+    << "\t -B, --batch_size <int>          number of small files (up to 64 KB) hashed\n"
+    << "\t                                 together by the multi-buffer md5 and sha1\n"
+    << "\t                                 kernels (SSE2, AVX2 or AVX-512 selected at\n"
+    << "\t                                 runtime). Used if all digests are md5 or\n"
+    << "\t                                 sha1. 0 or 1 disables batching (default: 32)\n"
+    << "\t -e, --elevator <mode>           hash files in ascending order of their disk\n"
+    << "\t                                 position to turn random seeks on rotating\n"
+    << "\t                                 disks into mostly sequential reads. The\n"
+    << "\t                                 position is the inode number (inode) or\n"
+    << "\t                                 the physical offset of the first extent\n"
+    << "\t                                 via FIEMAP/FIBMAP (extent; uses inode\n"
+    << "\t                                 numbers on file systems without either).\n"
+    << "\t -W, --elevator_window <int>     number of files ordered at a time by the\n"
+    << "\t                                 elevator (default: 16384)\n"
+    << "\t -D, --device_threads <spec>     hash files of each device (st_dev) with\n"
+    << "\t                                 their own group of hash threads so mixed\n"
+    << "\t                                 HDD, SSD and network trees keep every\n"
+    << "\t                                 device at its best concurrency. The spec\n"
+    << "\t                                 is auto or a comma separated list of\n"
+    << "\t                                 <hdd|ssd|other|major:minor>=<threads>.\n"
+    << "\t                                 The class is detected via the rotational\n"
+    << "\t                                 flag in sysfs (default: hdd=1, others\n"
+    << "\t                                 use hash_threads). With an elevator each\n"
+    << "\t                                 device is ordered separately.\n"
+    << "\t -i, --incremental               in compare mode, only rehash files whose\n"
+    << "\t                                 size, mtime, ctime, inode or device differ\n"
+    << "\t                                 from the reference and trust all others.\n"
+    << "\t -V, --verify                    in compare mode with a sampled digest,\n"
+    << "\t                                 fully rehash files whose sampled digest\n"
+    << "\t                                 differs with the underlying digest and\n"
+    << "\t                                 report the full digest as well.\n"
+    << "\t -p, --paranoid <rate>           in incremental mode, still rehash the given\n"
+    << "\t                                 fraction (0 to 1) of unchanged files.\n"
     << "\t -h, --help                      this message\n\n"
     << std::endl;
   exit(1);
@@ -149,18 +438,102 @@ void print_stats(const Stats& stats) {
   auto dur = now - stats.startTime();
   auto dur_ms = std::chrono::duration_cast<std::chrono::milliseconds>(dur);
   auto dur_count_s = dur_ms.count()/1000.0;
-  auto num_m_bytes = stats.num_bytes()/1024/1024;
+  auto num_m_bytes = stats.num_bytes()/1024.0/1024.0;
   std::cout << "\n\n"
             << "**********************************************\n"
             << "Final file and timing data:  \n"
             << "**********************************************\n"
             << "phantom version : " << version << "\n"
             << "date            : " << time_point_to_c_time(now) << "\n"
+            << std::fixed << std::setprecision(2)
             << "elapsed time    : " << dur_count_s << " s\n"
             << "files processed : " << stats.num_files() << "\n"
+            << "files trusted   : " << stats.num_trusted() << "\n"
+            << "files linked    : " << stats.num_linked() << " ("
+            << stats.linked_bytes()/1024.0/1024.0 << " MB not reread)\n"
+            << "files resumed   : " << stats.num_resumed() << "\n"
             << "data processed  : " << num_m_bytes << " MB\n"
             << "throughput      : " << num_m_bytes/dur_count_s << " MB/s\n"
-            << std::endl;
+            << "digest backends : " << fast_digest_implementations() << "\n";
+
+  // per read mode throughput is reported per thread, i.e. as bytes over the
+  // accumulated time threads spent reading and hashing
+  for (const auto& r : stats.read_stats()) {
+    auto secs = std::chrono::duration<double>(r.second.time).count();
+    auto mb = r.second.num_bytes/1024.0/1024.0;
+    std::cout << "read mode       : " << r.first << "  "
+              << (secs > 0 ? mb/secs : 0.0) << " MB/s per thread\n";
+  }
+
+  // push stalls indicate a slow consumer stage, pop stalls a slow producer
+  // stage
+  for (const auto& q : stats.queue_stats()) {
+    std::cout << std::left << std::setw(16) << q.name << ": capacity " << q.capacity
+              << ", max depth " << q.max_depth
+              << ", avg depth " << q.avg_depth
+              << ", push stall " << std::chrono::duration<double>(q.push_stall).count()
+              << " s, pop stall " << std::chrono::duration<double>(q.pop_stall).count()
+              << " s\n";
+  }
+
+  print_histogram("file sizes", stats.size_histogram(), format_size);
+  print_histogram("file read and hash times", stats.latency_histogram(),
+    format_duration);
+  std::cout << std::endl;
+}
+
+
+// print_histogram prints the non-empty buckets of a power of two histogram
+// with bucket bounds formatted by format
+static void print_histogram(const std::string& name, const Histogram& hist,
+  std::string (*format)(unsigned long long)) {
+
+  long long total = 0;
+  for (auto count : hist) {
+    total += count;
+  }
+  if (total == 0) {
+    return;
+  }
+
+  std::cout << "\n" << name << ":\n";
+  for (int b = 0; b < numHistBuckets; ++b) {
+    if (hist[b] == 0) {
+      continue;
+    }
+    std::string range = b == 0 ? "0"
+      : format(1ULL << (b-1)) + " - " + format(1ULL << b);
+    std::cout << "  " << std::left << std::setw(24) << range << std::right
+              << std::setw(12) << hist[b] << "  " << std::setw(6)
+              << 100.0 * hist[b] / total << " %\n";
+  }
+}
+
+
+// format_size formats a size in bytes with binary units
+std::string format_size(unsigned long long bytes) {
+  const char* units[] = {"B", "KB", "MB", "GB", "TB", "PB", "EB"};
+  int u = 0;
+  while (bytes >= 1024 && bytes % 1024 == 0 && u < 6) {
+    bytes /= 1024;
+    ++u;
+  }
+  return std::to_string(bytes) + " " + units[u];
+}
+
+
+// format_duration formats a duration in ns with a suitable unit
+std::string format_duration(unsigned long long ns) {
+  const char* units[] = {"ns", "us", "ms", "s"};
+  int u = 0;
+  double v = ns;
+  while (v >= 1000 && u < 3) {
+    v /= 1000;
+    ++u;
+  }
+  std::ostringstream os;
+  os << std::setprecision(3) << v << " " << units[u];
+  return os.str();
 }
 
 
@@ -7,14 +7,20 @@
 
 #include <cstdio>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
+#include <atomic>
 #include <exception>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
 
-#include "parallel_queue.hpp"
+#include "bounded_queue.hpp"
+#include "shard.hpp"
+#include "ws_queue.hpp"
 
 
 const std::string version = "0.2";
@@ -44,37 +50,95 @@ public:
 };
 
 
-// File is a thin wrapper class for managing C style filepointers
-class File {
+// forward declarations
+struct FileEntry;
+
+
+// Fd is a thin wrapper class for managing POSIX file descriptors
+class Fd {
 
 public:
 
-  File(const std::string& fileName);
-  ~File();
+  Fd(const std::string& fileName, int flags);
+  Fd(const FileEntry& file, int flags);
+  ~Fd();
 
-  FILE* get();
+  Fd(const Fd& fd) = delete;
+  Fd& operator=(const Fd& fd) = delete;
+
+  int get();
 
 private:
 
-  FILE *fp_;
+  int fd_;
 };
 
 
-// Dir is a thin wrapper class for managing C style directory pointers
-class Dir {
+// DirHandle is an open directory shared by all queued entries it contains.
+// Entries are opened and stat'ed relative to it so the kernel does not have
+// to resolve their full path. Without a descriptor (fd < 0, e.g. if too
+// many directories are open already) entries are accessed via their full
+// path instead.
+class DirHandle {
 
 public:
 
-  Dir(const std::string& dirName);
-  ~Dir();
+  // DirHandle takes ownership of fd. path must not have a trailing '/'.
+  DirHandle(std::string path, int fd);
+  ~DirHandle();
+
+  DirHandle(const DirHandle& d) = delete;
+  DirHandle& operator=(const DirHandle& d) = delete;
+
+  // fd returns the directory descriptor or AT_FDCWD if there is none
+  int fd() const { return fd_ >= 0 ? fd_ : AT_FDCWD; }
+  const std::string& path() const { return path_; }
+
+  // device returns the device of the directory. It is looked up on first
+  // use and cached so it costs one stat per directory. Returns false if the
+  // directory can not be stat'ed.
+  bool device(dev_t& dev) const;
+
+private:
+
+  std::string path_;
+  int fd_;
+  mutable std::atomic<bool> haveDev_{false};
+  mutable std::atomic<dev_t> dev_{0};
+};
+
 
-  DIR* get();
+// FileEntry refers to a file by its parent directory and name. The full
+// path is only assembled when needed (e.g. for output). Entries without a
+// directory name the file by its full path.
+struct FileEntry {
+
+  FileEntry() = default;
+  explicit FileEntry(std::string fullPath) : name(std::move(fullPath)) {};
+
+  // path stores the full path of the entry in out
+  void path(std::string& out) const;
+  std::string path() const;
+
+  // open and lstat access the file relative to its directory
+  int open(int flags) const;
+  int lstat(struct stat* info) const;
+
+  bool operator==(const FileEntry& f) const {
+    return dir == f.dir && name == f.name;
+  }
+
+  std::shared_ptr<const DirHandle> dir;
+  std::string name;
+  ino_t ino = 0;   // inode as reported by the directory entry (0 if unknown)
 
 private:
 
-  DIR *dp_;
+  const char* at_name(std::string& buf) const;
 };
 
+using FileQueue = Bqueue<FileEntry>;
+
 
 // Printer is a helper class for serializing stdout and stderr
 class Printer {
@@ -98,16 +162,15 @@ private:
 };
 
 
-// add_directory adds the content of the provided directory to the queue
-void add_directory(StringQueue& queue, const std::string& path,
-  const Printer& print);
+// size of the buffer directory entries are read into via getdents64
+const size_t dirBufferSize = 256*1024;
 
 
-// helper function to compute the buf size required for dirent for
-// the particular filesystem in use. Code used mostly verbatim from
-// http://womble.decadent.org.uk/readdir_r-advisory.html
-// Returns 0 on failure.
-size_t dirent_buf_size(DIR * dirp);
+// add_directory adds the subdirectories of the provided directory to the
+// deque of thread id and the contained regular files (owned by shard) to the
+// file queue
+void add_directory(StringWSQueue& dirQueue, int id, FileQueue& fileQueue,
+  const std::string& path, const Shard& shard, const Printer& print);
 
 
 // concat_filepaths concatenates two filepaths into one single path
@@ -126,7 +189,16 @@ void error(const std::string& msg);
 void print_stats(const Stats& stats);
 
 
+
 // convert a std::chrono::time_point to a human readable string
 std::string time_point_to_c_time(const std::chrono::system_clock::time_point& tp);
 
+
+// format_size formats a size in bytes with binary units
+std::string format_size(unsigned long long bytes);
+
+
+// format_duration formats a duration in ns with a suitable unit
+std::string format_duration(unsigned long long ns);
+
 #endif
@@ -1,82 +1,724 @@
-// worker describes the thread worker function
+// worker describes the thread worker functions of phantom's pipeline
 //
 // (C) Markus Dittrich 2015
 
 
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "checkpoint.hpp"
+#include "device.hpp"
+#include "elevator.hpp"
 #include "hash.hpp"
-#include "parallel_map.hpp"
+#include "output.hpp"
+#include "reader.hpp"
 #include "refParser.hpp"
+#include "refdb.hpp"
+#include "runs.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 #include "worker.hpp"
 
 
-static void compare_to_reference(const std::string& path, const std::string& hash,
-  const Printer& printer, RefData& rd);
+// FullHasher fully hashes files flagged by a sampled digest with the
+// underlying digest (--verify). Threads escalating files keep one around so
+// the read engine and hasher are only set up once.
+class FullHasher {
 
+public:
+
+  FullHasher(const CmdLineOpts& opts) {
+    SampleSpec spec;
+    parse_sample_digest(opts.digests[0], spec);
+    md_ = spec.md;
+    engine_ = make_read_engine(opts.readMode, opts.bufferSize, opts.queueDepth);
+    hasher_.reset(new Hasher({md_}, *engine_));
+  }
+
+  // hash returns the digest name followed by the full hash of file
+  std::string hash(const FileEntry& file) {
+    struct stat info;
+    if (file.lstat(&info) < 0) {
+      return md_ + " unreadable";
+    }
+    auto hash = hasher_->hash(file, info.st_size);
+    return md_ + " " + (hash.empty() ? "unreadable" : hash);
+  }
+
+private:
+
+  std::string md_;
+  std::unique_ptr<ReadEngine> engine_;
+  std::unique_ptr<Hasher> hasher_;
+};
+
+
+static void compare_to_reference(const HashResult& result,
+  const std::string& path, OutputBuffer& out, const RefData& rd,
+  const CmdLineOpts& opts);
+static void report_digests(const std::string& path, const std::string& hash,
+  const std::string& refMethod, const std::string& refHash,
+  const std::string& fullHash, OutputBuffer& out, const CmdLineOpts& opts);
+static std::string escalate_hash(const std::string& path,
+  const CmdLineOpts& opts);
+static void merge_compare(ResultQueue& results, OutputBuffer& out,
+  const CmdLineOpts& opts);
+static FileStatus check_reference(size_t refIndex, const FileMeta& meta,
+  const RefData& rd, CmdLineOpts& opts, std::mt19937_64& rng);
 
-// worker requests items from the queue which are either file or
-// directory paths. If item is
-// 1) a filepath: computes and prints the hash of the file
-// 2) a directory path: adds contained files and directories contained to
-//    the queue
-void worker(StringQueue& fileQueue, const Printer& printer, RefData& rd,
-  Stats& stats, CmdLineOpts& opts) {
 
-  // if we receive a non-empty refMap we compare against it
+// walker requests directory paths from the work stealing queue and adds
+// contained directories back to it while files are handed to the hash stage
+void walker(StringWSQueue& dirQueue, int id, FileQueue& fileQueue,
+  const Shard& shard, const Printer& printer) {
+
+  trace_thread_name("walker " + std::to_string(id));
+  std::string path;
+  while (dirQueue.pop(id, path)) {
+    if (!stop_requested()) {
+      add_directory(dirQueue, id, fileQueue, path, shard, printer);
+    }
+    dirQueue.task_done();
+  }
+}
+
+
+// elevator_worker hands the files of the file queue on to the disk queue
+// in disk order. Files are only dispatched once the window is full (or the
+// walkers are done) so the order covers as many files as possible.
+void elevator_worker(FileQueue& fileQueue, FileQueue& diskQueue,
+  const CmdLineOpts& opts) {
+
+  trace_thread_name("elevator");
+  auto mode = opts.elevator == "extent" ? PositionMode::probe
+    : PositionMode::inode;
+  Elevator elevator(opts.elevatorWindow);
+  FileEntry file;
+  while (fileQueue.pop(file)) {
+    auto pos = disk_position(file, mode);
+    elevator.add(pos, std::move(file));
+    if (elevator.full()) {
+      diskQueue.push(elevator.next());
+    }
+  }
+  while (!elevator.empty()) {
+    diskQueue.push(elevator.next());
+  }
+}
+
+
+// DeviceGroup is the queue and hash threads (and elevator) of a device.
+// Files which do not fit into the queue wait in the overflow list so the
+// dispatcher never blocks on a single device.
+struct DeviceGroup {
+  std::unique_ptr<FileQueue> fileQueue;
+  std::deque<FileEntry> overflow;
+  std::unique_ptr<FileQueue> diskQueue;
+  std::thread elevator;
+  std::vector<std::thread> hashers;
+};
+
+
+// device_worker hands the files of the file queue on to per device groups
+// of hash threads. Groups are started when the first file of a device shows
+// up. Files are handed off without blocking: once the queue of a slow
+// device is full its files are parked in the group's overflow list, which
+// is moved into the queue as room frees up, so the other devices keep
+// getting files. With an elevator every device gets its own since disk
+// positions are only comparable within a device.
+void device_worker(FileQueue& fileQueue, ResultQueue& results,
+  const Printer& printer, RefData& rd, InodeTable& inodes,
+  Checkpoint& checkpoint, Stats& stats, CmdLineOpts& opts) {
+
+  trace_thread_name("device dispatcher");
+  std::map<dev_t, DeviceGroup> groups;
+
+  // flush moves overflowing files into their device queues as far as there
+  // is room and returns true if any are left
+  auto flush = [&]() {
+    bool pending = false;
+    for (auto& d : groups) {
+      DeviceGroup& g = d.second;
+      while (!g.overflow.empty() && g.fileQueue->try_push(g.overflow.front())) {
+        g.overflow.pop_front();
+      }
+      pending = pending || !g.overflow.empty();
+    }
+    return pending;
+  };
+
+  const auto backoff = std::chrono::milliseconds(1);
+  FileEntry file;
+  while (true) {
+    // while a device is backed up the file queue is polled so its overflow
+    // can be flushed as soon as there is room
+    if (flush()) {
+      if (!fileQueue.try_pop(file)) {
+        if (fileQueue.drained()) {
+          break;
+        }
+        std::this_thread::sleep_for(backoff);
+        continue;
+      }
+    } else if (!fileQueue.pop(file)) {
+      break;
+    }
+
+    dev_t dev = 0;
+    file_device(file, dev);
+
+    auto it = groups.find(dev);
+    if (it == groups.end()) {
+      auto c = device_class(dev);
+      int n = opts.deviceLimits.threads(dev, c, opts.hashThreads);
+      std::string name = "device " + device_name(dev) + " (" + device_class_name(c)
+        + ", " + std::to_string(n) + " threads)";
+      DeviceGroup& g = groups[dev];
+      g.fileQueue.reset(new FileQueue(name, deviceQueueSize));
+      FileQueue* hashQueue = g.fileQueue.get();
+      if (!opts.elevator.empty()) {
+        g.diskQueue.reset(new FileQueue(name + " disk queue", 2 * n));
+        g.elevator = std::thread(elevator_worker, std::ref(*g.fileQueue),
+          std::ref(*g.diskQueue), std::cref(opts));
+        hashQueue = g.diskQueue.get();
+      }
+      for (int i = 0; i < n; ++i) {
+        g.hashers.push_back(std::thread(hash_worker, std::ref(*hashQueue),
+          std::ref(results), std::cref(printer), std::ref(rd), std::ref(inodes),
+          std::ref(checkpoint), std::ref(stats), std::ref(opts)));
+      }
+      it = groups.find(dev);
+    }
+    DeviceGroup& g = it->second;
+    if (!g.overflow.empty() || !g.fileQueue->try_push(file)) {
+      g.overflow.push_back(std::move(file));
+    }
+  }
+  while (flush()) {
+    std::this_thread::sleep_for(backoff);
+  }
+
+  for (auto& d : groups) {
+    DeviceGroup& g = d.second;
+    g.fileQueue->close();
+    if (g.elevator.joinable()) {
+      g.elevator.join();
+      g.diskQueue->close();
+    }
+    for (auto& t : g.hashers) {
+      t.join();
+    }
+    stats.add_queue_stats(g.fileQueue->stats());
+  }
+}
+
+
+// hash_worker requests files from the file queue, computes their hashes
+// and passes the results on to the output stage. Files are accessed
+// relative to their directory; the full path is only built for the
+// reference lookup. Files with several hard links are hashed once per
+// inode. Results are recorded in the checkpoint journal and files finished
+// by a previous run are not rehashed. Once the time budget is used up the
+// remaining files are skipped.
+void hash_worker(FileQueue& fileQueue, ResultQueue& results,
+  const Printer& printer, RefData& rd, InodeTable& inodes,
+  Checkpoint& checkpoint, Stats& stats, CmdLineOpts& opts) {
+
+  // if we receive a non-empty refDb we compare against it
   bool compare = false;
-  if (!rd.refMap.empty()) {
+  if (!rd.refDb.empty()) {
     compare = true;
   }
 
-  while (!fileQueue.done()) {
-    auto path = fileQueue.try_and_wait();
-    if (path.empty()) {
+  trace_thread_name("hash worker");
+  auto engine = make_read_engine(opts.readMode, opts.bufferSize, opts.queueDepth);
+  Hasher hasher(opts.digests, *engine, opts.treeThreads, opts.batchSize);
+  std::mt19937_64 rng(std::random_device{}());
+
+  // with --verify files whose sampled digest differs from the reference are
+  // fully hashed here so the output stage never has to read files. The
+  // paths of an inode share its full hash: it is either carried over by the
+  // inode table or passed in as full which is set once computed.
+  std::unique_ptr<FullHasher> fullHasher;
+  if (opts.verify) {
+    fullHasher.reset(new FullHasher(opts));
+  }
+  auto escalate = [&](HashResult& r, std::string& full) {
+    if (!fullHasher || r.status != FileStatus::hashed || r.hash.empty()
+      || r.refIndex == RefDb::npos
+      || compare_digests(opts.digests, r.hash, rd.refDb.method(r.refIndex),
+        rd.refDb.hash(r.refIndex)) != DigestMatch::differs) {
+      r.fullHash.clear();
+      return;
+    }
+    if (r.fullHash.empty()) {
+      r.fullHash = full.empty() ? fullHasher->hash(r.file) : full;
+    }
+    full = r.fullHash;
+  };
+
+  // publish records a result in the checkpoint journal and hands it to the
+  // output stage. If the file's inode was claimed the parked results of its
+  // other paths are passed on as well. Unreadable files (empty hash) are not
+  // journaled so they are retried on resume.
+  auto journal = [&](const HashResult& r) {
+    if (checkpoint.enabled() && r.status == FileStatus::hashed
+      && !r.hash.empty()) {
+      checkpoint.add(r.file.path(), r.hash, r.meta);
+    }
+  };
+  auto publish = [&](HashResult&& r, bool claimed) {
+    std::string full;
+    escalate(r, full);
+    if (claimed) {
+      for (auto& p : inodes.complete(r)) {
+        stats.add_linked(p.meta.size);
+        journal(p);
+        escalate(p, full);
+        results.push(std::move(p));
+      }
+    }
+    journal(r);
+    results.push(std::move(r));
+  };
+
+  // batch holds the results of small files waiting to be hashed together.
+  // The batch is finished once it is full or the file queue runs dry so
+  // files are never held back while we wait for more work.
+  // Each file is accounted with its read time plus its share of the
+  // batch's digest time.
+  struct BatchEntry {
+    HashResult result;
+    std::chrono::steady_clock::duration readTime;
+    bool claimed;
+  };
+  std::vector<BatchEntry> batch;
+  auto finish_batch = [&]() {
+    auto start = std::chrono::steady_clock::now();
+    auto hashes = hasher.finish_batch();
+    auto perFile = (std::chrono::steady_clock::now() - start) / batch.size();
+    for (size_t i = 0; i < batch.size(); ++i) {
+      HashResult& r = batch[i].result;
+      r.hash = std::move(hashes[i]);
+      stats.add(r.meta.size);
+      stats.add_read(batchFileMode, r.meta.size, batch[i].readTime + perFile);
+      publish(std::move(r), batch[i].claimed);
+    }
+    batch.clear();
+  };
+
+  // next holds an entry we grabbed ahead of time so the read engine can
+  // prefetch it while the current file is being hashed
+  FileEntry next;
+  bool haveNext = false;
+  std::string path;
+  while (true) {
+    FileEntry file;
+    if (haveNext) {
+      file = std::move(next);
+      haveNext = false;
+    } else if (!batch.empty() && !fileQueue.try_pop(file)) {
+      finish_batch();
+      continue;
+    } else if (batch.empty() && !fileQueue.pop(file)) {
       break;
     }
+    if (stop_requested()) {
+      continue;
+    }
 
-    // check if path is a directory or a file
+    // the stat is still needed for the metadata which is part of the output
+    // even though d_type told us the entry is a regular file
     struct stat info;
-    if (lstat(path.c_str(), &info) < 0) {
-      printer.cerr("lstat failed on " + path);
+    int rc;
+    {
+      TraceScope ts(TraceStage::lstat);
+      rc = file.lstat(&info);
+    }
+    if (rc < 0) {
+      printer.cerr("lstat failed on " + file.path());
+      continue;
+    }
+    if (!S_ISREG(info.st_mode)) {
       continue;
     }
-    if (S_ISREG(info.st_mode)) {
-      std::string hash = hasher(opts.hashMethod, path);
-      if (opts.collectStats) {
-        stats.add(info.st_size);
+
+    HashResult result;
+    result.meta = meta_from_stat(info);
+    if (compare) {
+      file.path(path);
+      result.refIndex = rd.refDb.find(path);
+      if (result.refIndex != RefDb::npos) {
+        rd.visited.set(result.refIndex);
+      }
+      result.status = check_reference(result.refIndex, result.meta, rd, opts, rng);
+    }
+
+    // files finished by a previous run take their journaled hash
+    if (result.status == FileStatus::hashed && checkpoint.num_loaded() > 0) {
+      file.path(path);
+      if (checkpoint.finished(path, result.meta, result.hash)) {
+        stats.add_resumed();
+        result.file = std::move(file);
+        std::string full;
+        escalate(result, full);
+        results.push(std::move(result));
+        continue;
+      }
+    }
+
+    bool claimed = false;
+    if (result.status == FileStatus::hashed && info.st_nlink > 1) {
+      result.file = std::move(file);
+      auto claim = inodes.claim(result, info.st_nlink);
+      if (claim == InodeTable::Claim::done) {
+        stats.add_linked(info.st_size);
+        publish(std::move(result), false);
+        continue;
+      } else if (claim == InodeTable::Claim::parked) {
+        continue;
+      }
+      file = std::move(result.file);
+      claimed = true;
+    }
+
+    if (result.status == FileStatus::hashed) {
+      // small files and sampled digests bypass the read engine so
+      // prefetching would only add an extra open (or whole file readahead)
+      bool small = Hasher::is_small(info.st_size);
+      if (small && hasher.batching()) {
+        auto start = std::chrono::steady_clock::now();
+        hasher.add_to_batch(file, info.st_size);
+        auto readTime = std::chrono::steady_clock::now() - start;
+        result.file = std::move(file);
+        batch.push_back({std::move(result), readTime, claimed});
+        if (hasher.batch_full()) {
+          finish_batch();
+        }
+        continue;
+      }
+      if (!small && !hasher.sampled() && fileQueue.try_pop(next)) {
+        haveNext = true;
+        engine->prefetch(next);
       }
-      if (compare) {
-        compare_to_reference(path, hash, printer, rd);
+
+      // stats are always collected since they also feed progress reports
+      auto start = std::chrono::steady_clock::now();
+      result.hash = hasher.hash(file, info.st_size);
+      auto dur = std::chrono::steady_clock::now() - start;
+      stats.add(info.st_size);
+      if (hasher.sampled()) {
+        stats.add_read(sampleFileMode, hasher.sampled_bytes(info.st_size), dur);
       } else {
-        printer.cout(opts.hashMethod + " , " + path + " , " + hash);
+        stats.add_read(small ? smallFileMode : engine->name(), info.st_size, dur);
       }
-    } else if (S_ISDIR(info.st_mode)) {
-      add_directory(fileQueue, path, printer);
     }
+    result.file = std::move(file);
+    publish(std::move(result), claimed);
   }
 }
 
 
-// compare_to_reference is a short helper function for checking if a file is
-// in the reference data set and if yes if the hash matches. Otherwise prints
-// an error message.
-static void compare_to_reference(const std::string& path, const std::string& hash,
-  const Printer& printer, RefData& rd) {
-
-  rd.fileMap[path] = 1;
-  auto r = rd.refMap.find(path);
-  if (r != rd.refMap.end()) {
-    if (r->second != hash) {
-      printer.cout("hash differs    :  " + path + "  found(" + hash
-        + ") expected(" + r->second + ")");
+// claim looks up the inode of result. The first path of an inode has to
+// hash it; later ones take the hash if done or are parked otherwise.
+InodeTable::Claim InodeTable::claim(HashResult& result, nlink_t links) {
+  Key k{result.meta.dev, result.meta.ino};
+  Shard& s = shard(k);
+  std::lock_guard<std::mutex> lg(s.mx);
+  auto it = s.entries.find(k);
+  if (it == s.entries.end()) {
+    s.entries[k].remaining = links - 1;
+    return Claim::first;
+  }
+  Entry& e = it->second;
+  if (e.remaining > 0) {
+    --e.remaining;
+  }
+  if (e.done) {
+    result.hash = e.hash;
+    result.fullHash = e.fullHash;
+    if (e.remaining == 0) {
+      s.entries.erase(it);
     }
+    return Claim::done;
+  }
+  e.parked.push_back(std::move(result));
+  return Claim::parked;
+}
+
+
+// complete records the hash of the inode of result and returns the parked
+// results of its other paths with their hash filled in. The entry is
+// dropped right away if all links were seen already.
+std::vector<HashResult> InodeTable::complete(const HashResult& result) {
+  Key k{result.meta.dev, result.meta.ino};
+  Shard& s = shard(k);
+  std::lock_guard<std::mutex> lg(s.mx);
+  auto it = s.entries.find(k);
+  std::vector<HashResult> parked;
+  parked.swap(it->second.parked);
+  for (auto& p : parked) {
+    p.hash = result.hash;
+    p.fullHash = result.fullHash;
+  }
+  if (it->second.remaining == 0) {
+    s.entries.erase(it);
   } else {
-    printer.cout("extra file      :  " + path + " with hash(" + hash + ")");
+    it->second.done = true;
+    it->second.hash = result.hash;
+    it->second.fullHash = result.fullHash;
+  }
+  return parked;
+}
+
+
+// output_worker either prints the results of the hash stage, stores them in
+// a binary reference database or compares them against the reference
+void output_worker(ResultQueue& results, const Printer& printer, RefData& rd,
+  Stats& stats, CmdLineOpts& opts) {
+
+  // streaming compare results are already in path order
+  OutputBuffer out(opts.sorted && !opts.streaming, opts.tmpDir);
+  if (opts.streaming) {
+    merge_compare(results, out, opts);
+    out.finish();
+    return;
+  }
+
+  bool compare = false;
+  if (!rd.refDb.empty()) {
+    compare = true;
+  }
+
+  RefDbBuilder builder;
+  std::string line;
+  std::string path;
+  HashResult r;
+  while (results.pop(r)) {
+    r.file.path(path);
+    if (!compare && !opts.outputDbPath.empty()) {
+      RefEntry entry;
+      entry.method = opts.hashMethod;
+      entry.hash = std::move(r.hash);
+      entry.hasMeta = true;
+      entry.meta = r.meta;
+      if (!builder.add(path, entry)) {
+        printer.cerr("failed to add " + path + " to reference database");
+      }
+      continue;
+    } else if (!compare) {
+      line.clear();
+      line.append(opts.hashMethod).append(" , ").append(path).append(" , ")
+        .append(r.hash).append(" , ");
+      append_meta(line, r.meta);
+      out.add_line(path, line);
+      continue;
+    }
+
+    switch (r.status) {
+      case FileStatus::hashed:
+        compare_to_reference(r, path, out, rd, opts);
+        break;
+
+      case FileStatus::trusted:
+        stats.add_trusted();
+        break;
+
+      case FileStatus::sizeChanged:
+        out.add_line(path, "hash differs    :  " + path + "  found(size "
+          + std::to_string(r.meta.size) + ") expected(size "
+          + std::to_string(rd.refDb.meta(r.refIndex).size) + ")");
+        break;
+    }
+  }
+  out.finish();
+
+  if (!compare && !opts.outputDbPath.empty()) {
+    builder.build().write(opts.outputDbPath);
+  }
+}
+
+
+// compare_to_reference is a short helper function for checking if a file is
+// in the reference data set and if yes if the hashes match. If file and
+// reference were hashed with different sets of digests only the digests
+// present in both are compared. Otherwise prints an error message.
+static void compare_to_reference(const HashResult& result,
+  const std::string& path, OutputBuffer& out, const RefData& rd,
+  const CmdLineOpts& opts) {
+
+  auto r = result.refIndex;
+  if (r == RefDb::npos) {
+    out.add_line(path, "extra file      :  " + path + " with hash("
+      + result.hash + ")");
+    return;
+  }
+
+  // the common case of identical digests is compared in place
+  const auto& method = rd.refDb.method(r);
+  if (method == opts.hashMethod && rd.refDb.hash_equals(r, result.hash)) {
+    return;
+  }
+  report_digests(path, result.hash, method, rd.refDb.hash(r), result.fullHash,
+    out, opts);
+}
+
+
+// report_digests compares a file's digests against its reference digests
+// and prints any difference. With --verify, flagged files carry the full
+// hash computed by the hash stage (fullHash); in streaming mode the merge
+// runs after all files were hashed and fully hashes them itself.
+static void report_digests(const std::string& path, const std::string& hash,
+  const std::string& refMethod, const std::string& refHash,
+  const std::string& fullHash, OutputBuffer& out, const CmdLineOpts& opts) {
+
+  switch (compare_digests(opts.digests, hash, refMethod, refHash)) {
+    case DigestMatch::same:
+      break;
+
+    case DigestMatch::differs:
+      if (opts.verify) {
+        out.add_line(path, "hash differs    :  " + path + "  found(" + hash
+          + ") expected(" + refHash + ") full("
+          + (fullHash.empty() ? escalate_hash(path, opts) : fullHash) + ")");
+        break;
+      }
+      out.add_line(path, "hash differs    :  " + path + "  found(" + hash
+        + ") expected(" + refHash + ")");
+      break;
+
+    case DigestMatch::noCommon:
+      out.add_line(path, "no common digest:  " + path + "  found(" + opts.hashMethod
+        + ") expected(" + refMethod + ")");
+      break;
+  }
+}
+
+
+// escalate_hash fully hashes a file flagged by a sampled digest on the
+// output thread (streaming mode only)
+static std::string escalate_hash(const std::string& path,
+  const CmdLineOpts& opts) {
+
+  static FullHasher fullHasher(opts);
+  return fullHasher.hash(FileEntry(path));
+}
+
+
+// merge_compare sorts the results of the hash stage with an external sort
+// and merges them with the path sorted reference. Differences are reported
+// as the merge proceeds so neither side is ever held in memory in full.
+static void merge_compare(ResultQueue& results, OutputBuffer& out,
+  const CmdLineOpts& opts) {
+
+  RunSorter sorter(opts.tmpDir);
+  HashResult r;
+  while (results.pop(r)) {
+    std::string value(reinterpret_cast<const char*>(&r.meta), sizeof(r.meta));
+    value.append(r.hash);
+    sorter.add(r.file.path(), std::move(value));
+  }
+  sorter.finish();
+  compare_sorted([&](std::string& path, std::string& value) {
+    return sorter.next(path, value);
+  }, out, opts);
+}
+
+
+// compare_sorted merges the path sorted results with the path sorted
+// reference and reports differences as the merge proceeds
+void compare_sorted(const SortedResults& found, OutputBuffer& out,
+  const CmdLineOpts& opts) {
+
+  try {
+    RefReader ref(opts.referenceFilePath);
+    std::string refPath;
+    std::string prevRefPath;
+    RefEntry entry;
+    auto next_ref = [&]() {
+      prevRefPath = std::move(refPath);
+      if (!ref.next(refPath, entry)) {
+        return false;
+      }
+      if (!prevRefPath.empty() && refPath <= prevRefPath) {
+        error("reference " + opts.referenceFilePath + " is not sorted by path; "
+          "convert it with --convert first");
+      }
+      return true;
+    };
+
+    std::string path;
+    std::string value;
+    bool haveRef = next_ref();
+    bool haveFound = found(path, value);
+    while (haveRef || haveFound) {
+      int c = !haveRef ? -1 : (!haveFound ? 1 : path.compare(refPath));
+      if (c > 0) {
+        // a stopped scan did not visit all files
+        if (!scan_stopped()) {
+          out.add_line(refPath, "file disappeared:  " + refPath);
+        }
+        haveRef = next_ref();
+        continue;
+      }
+
+      FileMeta meta;
+      memcpy(&meta, value.data(), sizeof(meta));
+      auto hash = value.substr(sizeof(meta));
+      if (c < 0) {
+        out.add_line(path, "extra file      :  " + path + " with hash(" + hash + ")");
+      } else if (entry.hasMeta && entry.meta.size != meta.size) {
+        out.add_line(path, "hash differs    :  " + path + "  found(size "
+          + std::to_string(meta.size) + ") expected(size "
+          + std::to_string(entry.meta.size) + ")");
+      } else {
+        report_digests(path, hash, entry.method, entry.hash, "", out, opts);
+      }
+      if (c == 0) {
+        haveRef = next_ref();
+      }
+      haveFound = found(path, value);
+    }
+  } catch (std::runtime_error& e) {
+    error(e.what());
+  }
+}
+
+
+// check_reference uses the reference metadata (if present) to decide if a
+// file needs to be hashed. Files whose size differs from the reference are
+// not hashed since they changed for sure. In incremental mode files with
+// unchanged metadata are trusted unless they are picked for paranoid
+// resampling.
+static FileStatus check_reference(size_t refIndex, const FileMeta& meta,
+  const RefData& rd, CmdLineOpts& opts, std::mt19937_64& rng) {
+
+  if (refIndex == RefDb::npos || !rd.refDb.has_meta(refIndex)) {
+    return FileStatus::hashed;
+  }
+
+  auto ref = rd.refDb.meta(refIndex);
+  if (ref.size != meta.size) {
+    return FileStatus::sizeChanged;
+  }
+
+  if (!opts.incremental || !(ref == meta)) {
+    return FileStatus::hashed;
+  }
+  if (opts.paranoidRate > 0.0
+      && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < opts.paranoidRate) {
+    return FileStatus::hashed;
   }
+  return FileStatus::trusted;
 }
@@ -1,33 +1,187 @@
-// worker describes the thread worker function
+// worker describes the thread worker functions of phantom's pipeline:
+//
+//   walker threads  --(file queue)-->  hash threads  --(result queue)-->  output
+//
+// Walker threads traverse the directory tree, hash threads compute file
+// digests and a single output thread prints results or compares them
+// against the reference. With an elevator an extra stage between walkers
+// and hash threads reorders files by their position on disk:
+//
+//   walker threads  --(file queue)-->  elevator  --(disk queue)-->  hash threads
+//
+// With device groups files are dispatched to a queue per device, each with
+// its own hash threads (and elevator):
+//
+//   walker threads  --(file queue)-->  dispatcher  --(device queues)-->  hash threads
 //
 // (C) Markus Dittrich 2015
 
 #ifndef WORKER_HPP
 #define WORKER_HPP
 
+#include <array>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "atomic_bitset.hpp"
+#include "bounded_queue.hpp"
+#include "checkpoint.hpp"
 #include "cmdline.hpp"
-#include "parallel_map.hpp"
+#include "output.hpp"
 #include "refParser.hpp"
+#include "refdb.hpp"
 #include "stats.hpp"
+#include "util.hpp"
+#include "ws_queue.hpp"
 
 
 struct RefData {
-  ReferenceMap refMap;    // reference map of files and hashes to compare to
-  StringMap fileMap;      // map of all files found (so missing items can be identified)
+  RefDb refDb;            // reference database of files and hashes to compare to
+  AtomicBitset visited;   // reference entries found (so missing items can be identified)
+};
+
+
+// FileStatus describes how the hash stage dealt with a file
+enum class FileStatus {
+  hashed,       // file was hashed
+  trusted,      // metadata matches the reference so the file was not hashed
+  sizeChanged   // size differs from the reference so the file was not hashed
+};
+
+
+// HashResult is handed from the hash stage to the output stage
+struct HashResult {
+  FileEntry file;
+  std::string hash;
+  FileMeta meta;
+  FileStatus status = FileStatus::hashed;
+  size_t refIndex = RefDb::npos;  // index of the reference entry if any
+  std::string fullHash;           // full digest of a file flagged by --verify
 };
 
-// worker requests items from the queue which are either file or
-// directory paths. If item is
-// 1) a filepath: computes and prints the hash of the file
-// 2) a directory path: adds contained files and directories contained to
-//    the queue
-void worker(StringQueue& queue, const Printer& print, RefData& rd, Stats& stats,
+using ResultQueue = Bqueue<HashResult>;
+
+
+// InodeTable makes sure files with several hard links are only hashed
+// once. The first path of an inode claims it and hashes the file; results
+// of later paths either take the finished hash right away or are parked in
+// the table until the claiming thread completes the inode. Parking instead
+// of waiting keeps hash threads from blocking on each other. Entries are
+// dropped once all links of an inode were seen; only inodes with links
+// outside the scanned tree stay until the end of the scan.
+class InodeTable {
+
+public:
+
+  enum class Claim {
+    first,      // the caller has to hash the file and call complete
+    done,       // the hash was filled in from an earlier path
+    parked      // the result was taken over by the table
+  };
+
+  InodeTable() = default;
+  InodeTable(const InodeTable& t) = delete;
+  InodeTable& operator=(const InodeTable& t) = delete;
+
+  // claim looks up the inode of result (via its meta data) which has links
+  // hard links
+  Claim claim(HashResult& result, nlink_t links);
+
+  // complete records hash (and fullHash) for the inode of result and
+  // returns the parked results of other paths of the inode with their
+  // hashes filled in
+  std::vector<HashResult> complete(const HashResult& result);
+
+private:
+
+  struct Key {
+    unsigned long long dev;
+    unsigned long long ino;
+
+    bool operator==(const Key& k) const {
+      return dev == k.dev && ino == k.ino;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const {
+      return std::hash<unsigned long long>()(k.ino * 0x9e3779b97f4a7c15ULL
+        ^ k.dev);
+    }
+  };
+
+  struct Entry {
+    nlink_t remaining = 0;  // links not seen yet
+    bool done = false;
+    std::string hash;
+    std::string fullHash;   // --verify full hash if one was computed
+    std::vector<HashResult> parked;
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mx;
+    std::unordered_map<Key, Entry, KeyHash> entries;
+  };
+
+  static const int numShards = 64;
+
+  Shard& shard(const Key& k) {
+    return shards_[KeyHash()(k) % numShards];
+  }
+
+  std::array<Shard, numShards> shards_;
+};
+
+
+// walker requests directory paths from the work stealing queue and adds
+// contained directories back to it while files are handed to the hash stage.
+// Once the time budget is used up the remaining directories are skipped.
+void walker(StringWSQueue& dirQueue, int id, FileQueue& fileQueue,
+  const Shard& shard, const Printer& print);
+
+
+// elevator_worker hands the files of the file queue on to the disk queue in
+// disk order (see elevator.hpp)
+void elevator_worker(FileQueue& fileQueue, FileQueue& diskQueue,
+  const CmdLineOpts& opts);
+
+
+// device_worker hands the files of the file queue on to per device groups
+// of hash threads (see device.hpp) which pass their results on to the
+// output stage
+void device_worker(FileQueue& fileQueue, ResultQueue& results,
+  const Printer& print, RefData& rd, InodeTable& inodes,
+  Checkpoint& checkpoint, Stats& stats, CmdLineOpts& opts);
+
+
+// hash_worker requests files from the file queue, computes their hashes
+// and passes the results on to the output stage. Files with several hard
+// links are hashed once per inode (see InodeTable). Results are recorded in
+// the checkpoint journal (see checkpoint.hpp).
+void hash_worker(FileQueue& fileQueue, ResultQueue& results, const Printer& print,
+  RefData& rd, InodeTable& inodes, Checkpoint& checkpoint, Stats& stats,
   CmdLineOpts& opts);
 
-#endif
 
+// output_worker either prints the results of the hash stage, stores them in
+// a binary reference database or compares them against the reference. In
+// streaming mode the results are merged with the path sorted reference.
+void output_worker(ResultQueue& results, const Printer& print, RefData& rd,
+  Stats& stats, CmdLineOpts& opts);
+
+
+// SortedResults returns the next path sorted result as path and value (the
+// raw FileMeta followed by the hash); returns false at the end
+using SortedResults = std::function<bool(std::string& path, std::string& value)>;
 
 
+// compare_sorted compares the path sorted results against the path sorted
+// reference (opts.referenceFilePath) and prints all differences to out
+void compare_sorted(const SortedResults& found, OutputBuffer& out,
+  const CmdLineOpts& opts);
+
+#endif
@@ -0,0 +1,266 @@
+// WSqueue is a work stealing scheduler. Each thread owns a Chase-Lev deque
+// it pushes to and pops from at the bottom without taking any locks. Idle
+// threads steal from the top of other threads' deques via a single CAS.
+// Elements are moved into and out of the queue, never copied.
+//
+// Termination: every pushed element counts as pending until the thread that
+// popped it calls task_done() (after pushing any follow up work). Once the
+// pending count drops to zero no more work can appear and pop() returns
+// false in all threads.
+//
+// (C) Markus Dittrich 2015
+
+#ifndef WS_QUEUE_HPP
+#define WS_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// WSdeque is the per thread Chase-Lev deque (see Le et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models", PPoPP 2013). push() and
+// take() may only be called by the owning thread, steal() by anyone.
+template <typename T>
+class WSdeque {
+
+public:
+
+  WSdeque(int64_t capacity = 1024) {
+    array_.store(new Array(capacity), std::memory_order_relaxed);
+  }
+
+  ~WSdeque() {
+    auto a = array_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    for (int64_t i = t; i < b; ++i) {
+      delete a->get(i);
+    }
+    delete a;
+    for (auto r : retired_) {
+      delete r;
+    }
+  }
+
+  WSdeque(const WSdeque& d) = delete;
+  WSdeque& operator=(const WSdeque& d) = delete;
+
+  int64_t size() const {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+  }
+
+  void push(T* elem) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    auto a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+      a = grow(a, t, b);
+    }
+    a->put(b, elem);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  T* take() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    auto a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    T* elem = nullptr;
+    if (t <= b) {
+      elem = a->get(b);
+      if (t == b) {
+        // last element; race against thieves
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+            std::memory_order_relaxed)) {
+          elem = nullptr;
+        }
+        bottom_.store(b + 1, std::memory_order_relaxed);
+      }
+    } else {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return elem;
+  }
+
+  T* steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return nullptr;
+    }
+    auto a = array_.load(std::memory_order_acquire);
+    T* elem = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+        std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return elem;
+  }
+
+private:
+
+  struct Array {
+    Array(int64_t c) : capacity(c), mask(c - 1), buf(new std::atomic<T*>[c]) {};
+
+    T* get(int64_t i) const {
+      return buf[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T* elem) {
+      buf[i & mask].store(elem, std::memory_order_relaxed);
+    }
+
+    int64_t capacity;
+    int64_t mask;
+    std::unique_ptr<std::atomic<T*>[]> buf;
+  };
+
+  // grow doubles the capacity of the circular buffer. The old buffer is
+  // kept alive until destruction since thieves may still read from it.
+  Array* grow(Array* a, int64_t t, int64_t b) {
+    auto n = new Array(2 * a->capacity);
+    for (int64_t i = t; i < b; ++i) {
+      n->put(i, a->get(i));
+    }
+    retired_.push_back(a);
+    array_.store(n, std::memory_order_release);
+    return n;
+  }
+
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  std::atomic<Array*> array_;
+  std::vector<Array*> retired_;
+};
+
+
+template <typename T>
+class WSqueue {
+
+public:
+
+  WSqueue(int num_threads) : deques_(num_threads) {
+    for (auto& d : deques_) {
+      d = std::make_unique<WSdeque<T>>();
+    }
+  };
+
+  WSqueue(const WSqueue& q) = delete;
+  WSqueue& operator=(const WSqueue& q) = delete;
+
+  // approximate number of queued elements
+  int64_t size() const {
+    int64_t s = 0;
+    for (const auto& d : deques_) {
+      s += d->size();
+    }
+    return s;
+  }
+
+  // push moves elem onto the deque of thread id
+  void push(int id, T&& elem) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    deques_[id]->push(new T(std::move(elem)));
+    if (num_sleeping_.load(std::memory_order_seq_cst) > 0) {
+      std::lock_guard<std::mutex> lg(mx_);
+      wakeup_.notify_one();
+    }
+  }
+
+  // try_pop moves an element into elem without blocking. Returns false if
+  // no work was found.
+  bool try_pop(int id, T& elem) {
+    T* e = deques_[id]->take();
+    if (e == nullptr) {
+      e = steal(id);
+    }
+    if (e == nullptr) {
+      return false;
+    }
+    elem = std::move(*e);
+    delete e;
+    return true;
+  }
+
+  // pop moves the next element for thread id into elem, waiting for work if
+  // necessary. Returns false once all work is done.
+  bool pop(int id, T& elem) {
+    int spins = 0;
+    while (true) {
+      if (try_pop(id, elem)) {
+        return true;
+      }
+      if (pending_.load(std::memory_order_acquire) == 0) {
+        wake_all();
+        return false;
+      }
+
+      // back off: spin briefly, then yield, then sleep until woken up by a
+      // push. The timed wait guards against lost wakeups.
+      if (++spins < 64) {
+        continue;
+      } else if (spins < 128) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::unique_lock<std::mutex> ul(mx_);
+      num_sleeping_.fetch_add(1, std::memory_order_seq_cst);
+      if (size() == 0 && pending_.load(std::memory_order_acquire) != 0) {
+        wakeup_.wait_for(ul, std::chrono::milliseconds(1));
+      }
+      num_sleeping_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+  }
+
+  // task_done marks a previously popped element as completely processed
+  void task_done() {
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      wake_all();
+    }
+  }
+
+  bool done() const {
+    return pending_.load(std::memory_order_acquire) == 0;
+  }
+
+private:
+
+  T* steal(int id) {
+    int n = deques_.size();
+    for (int i = 1; i < n; ++i) {
+      T* e = deques_[(id + i) % n]->steal();
+      if (e != nullptr) {
+        return e;
+      }
+    }
+    return nullptr;
+  }
+
+  void wake_all() {
+    std::lock_guard<std::mutex> lg(mx_);
+    wakeup_.notify_all();
+  }
+
+  std::vector<std::unique_ptr<WSdeque<T>>> deques_;
+  alignas(64) std::atomic<long> pending_{0};
+  alignas(64) std::atomic<int> num_sleeping_{0};
+  std::mutex mx_;
+  std::condition_variable wakeup_;
+};
+
+using StringWSQueue = WSqueue<std::string>;
+
+#endif
@@ -0,0 +1,138 @@
+// this file implements the 64 bit xxHash (XXH64) with seed 0 following the
+// reference specification at https://github.com/Cyan4973/xxHash
+//
+// (C) Markus Dittrich, 2015
+
+#include <cstdio>
+#include <cstring>
+
+#include "fast_digest.hpp"
+
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t read64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+
+static inline uint32_t read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+
+static inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * prime2;
+  acc = rotl(acc, 31);
+  return acc * prime1;
+}
+
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+  acc ^= round(0, val);
+  return acc * prime1 + prime4;
+}
+
+
+void Xxh64Digest::update(const char* buf, size_t size) {
+  auto p = reinterpret_cast<const unsigned char*>(buf);
+  totalLen_ += size;
+
+  if (bufFill_ + size < 32) {
+    memcpy(buf_ + bufFill_, p, size);
+    bufFill_ += size;
+    return;
+  }
+
+  if (bufFill_ > 0) {
+    size_t n = 32 - bufFill_;
+    memcpy(buf_ + bufFill_, p, n);
+    for (int i = 0; i < 4; ++i) {
+      v_[i] = round(v_[i], read64(buf_ + 8*i));
+    }
+    p += n;
+    size -= n;
+    bufFill_ = 0;
+  }
+
+  // main loop over 32 byte stripes; the four lanes are independent
+  uint64_t v1 = v_[0], v2 = v_[1], v3 = v_[2], v4 = v_[3];
+  while (size >= 32) {
+    v1 = round(v1, read64(p));
+    v2 = round(v2, read64(p + 8));
+    v3 = round(v3, read64(p + 16));
+    v4 = round(v4, read64(p + 24));
+    p += 32;
+    size -= 32;
+  }
+  v_[0] = v1; v_[1] = v2; v_[2] = v3; v_[3] = v4;
+
+  memcpy(buf_, p, size);
+  bufFill_ = size;
+}
+
+
+std::string Xxh64Digest::final() {
+  uint64_t h;
+  if (totalLen_ >= 32) {
+    h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+    for (int i = 0; i < 4; ++i) {
+      h = merge_round(h, v_[i]);
+    }
+  } else {
+    h = v_[2] + prime5;
+  }
+  h += totalLen_;
+
+  const unsigned char* p = buf_;
+  size_t size = bufFill_;
+  while (size >= 8) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * prime1 + prime4;
+    p += 8;
+    size -= 8;
+  }
+  if (size >= 4) {
+    h ^= static_cast<uint64_t>(read32(p)) * prime1;
+    h = rotl(h, 23) * prime2 + prime3;
+    p += 4;
+    size -= 4;
+  }
+  while (size > 0) {
+    h ^= (*p) * prime5;
+    h = rotl(h, 11) * prime1;
+    ++p;
+    --size;
+  }
+
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+
+  unsigned char digest[8];
+  for (int i = 0; i < 8; ++i) {
+    digest[i] = static_cast<unsigned char>(h >> (56 - 8*i));
+  }
+  return to_hex(digest, sizeof(digest));
+}
+
+
+void Xxh64Digest::reset() {
+  *this = Xxh64Digest();
+}